@@ -0,0 +1,124 @@
+#include "mem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+// Over-aligned math and physics objects. 100k objects are made with New<T>, which passes alignof(T), then random
+// objects are deleted and made again. The heap is aligned to 64 bytes, so every one of these types can come from
+// a slab. Reports the pages used, the time per create and per delete + create, and any misaligned pointer.
+
+struct alignas(16) Vec4 {
+	float v[4];
+};
+
+struct alignas(16) Mat4 {
+	Vec4 rows[4];
+};
+
+struct alignas(32) Transform {
+	float position[3];
+	float rotation[4];
+	float scale;
+};
+
+struct alignas(64) RigidBody {
+	Mat4 world;
+	Vec4 velocity;
+	Vec4 angularVelocity;
+	float mass;
+	float inverseMass;
+};
+
+struct alignas(16) Contact {
+	Vec4 point;
+	Vec4 normal;
+	float depth;
+};
+
+static const u32 NumObjects = 100000;
+static const u32 NumOperations = 2000000;
+static const u32 NumKinds = 5;
+
+static unsigned long long randomState = 88172645463325252ull;
+
+static u32 Random() {
+	randomState ^= randomState << 13;
+	randomState ^= randomState >> 7;
+	randomState ^= randomState << 17;
+	return (u32)(randomState >> 11);
+}
+
+static void* Create(Memory::Allocator* allocator, u32 kind) {
+	switch (kind) {
+	case 0: return allocator->New<Vec4>();
+	case 1: return allocator->New<Mat4>();
+	case 2: return allocator->New<Transform>();
+	case 3: return allocator->New<RigidBody>();
+	default: return allocator->New<Contact>();
+	}
+}
+
+static void Destroy(Memory::Allocator* allocator, void* object, u32 kind) {
+	switch (kind) {
+	case 0: allocator->Delete((Vec4*)object); break;
+	case 1: allocator->Delete((Mat4*)object); break;
+	case 2: allocator->Delete((Transform*)object); break;
+	case 3: allocator->Delete((RigidBody*)object); break;
+	default: allocator->Delete((Contact*)object); break;
+	}
+}
+
+static bool IsAligned(void* object, u32 kind) {
+	static const u32 alignments[NumKinds] = { alignof(Vec4), alignof(Mat4), alignof(Transform), alignof(RigidBody), alignof(Contact) };
+	return (Memory::ptr_type)object % alignments[kind] == 0;
+}
+
+int main() {
+	u32 size = 1024u * 1024 * 1024 + 4096;
+	void* memory = malloc(size);
+	if (memory == 0) {
+		printf("Could not reserve memory for the benchmark\n");
+		return 1;
+	}
+
+	void* aligned = memory;
+	u32 alignedSize = size;
+	Memory::AlignAndTrim(&aligned, &alignedSize, 64);
+	Memory::Allocator* allocator = Memory::Initialize(aligned, alignedSize);
+	const u32 pagesBefore = allocator->numPagesUsed;
+
+	static void* objects[NumObjects];
+	u32 numMisaligned = 0;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (u32 i = 0; i < NumObjects; ++i) {
+		objects[i] = Create(allocator, i % NumKinds);
+	}
+	std::chrono::duration<double, std::nano> create = std::chrono::steady_clock::now() - start;
+
+	for (u32 i = 0; i < NumObjects; ++i) {
+		numMisaligned += IsAligned(objects[i], i % NumKinds) ? 0 : 1;
+	}
+	const u32 pagesUsed = allocator->numPagesUsed - pagesBefore;
+
+	start = std::chrono::steady_clock::now();
+	for (u32 i = 0; i < NumOperations; ++i) {
+		const u32 object = Random() % NumObjects;
+		Destroy(allocator, objects[object], object % NumKinds);
+		objects[object] = Create(allocator, object % NumKinds);
+	}
+	std::chrono::duration<double, std::nano> churn = std::chrono::steady_clock::now() - start;
+
+	for (u32 i = 0; i < NumObjects; ++i) {
+		numMisaligned += IsAligned(objects[i], i % NumKinds) ? 0 : 1;
+		Destroy(allocator, objects[i], i % NumKinds);
+	}
+
+	printf("%u objects: %u pages (%.1f MiB), create %.1f ns, delete + create %.1f ns, misaligned %u\n", NumObjects, pagesUsed,
+		pagesUsed * (double)allocator->pageSize / (1024.0 * 1024.0), create.count() / NumObjects, churn.count() / NumOperations, numMisaligned);
+
+	Memory::Shutdown(allocator);
+	free(memory);
+	return numMisaligned == 0 ? 0 : 1;
+}
@@ -0,0 +1,96 @@
+#include "mem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+// Large allocation latency on heaps with more than 100k pages. Every benchmark fills the heap, then times
+// allocating and releasing one large block many times, so only the page search is measured.
+
+static const int Repeats = 2000;
+
+static double MicrosecondsSince(std::chrono::high_resolution_clock::time_point start) {
+	std::chrono::duration<double, std::micro> elapsed = std::chrono::high_resolution_clock::now() - start;
+	return elapsed.count();
+}
+
+static void ReleaseLarge(Memory::Allocator* allocator, void* memory) {
+	if (memory == 0) {
+		printf("Large allocation failed, the benchmark is not measuring the page search\n");
+		exit(1);
+	}
+	allocator->Release(memory);
+}
+
+// 512 MiB heap (131072 pages), where every third page is a one page hole. A 256 page run only exists past the
+// end of the fragmented part, so the search has to walk all of it.
+static void Fragmented(void* memory, u32 size) {
+	Memory::Allocator* allocator = Memory::Initialize(memory, size);
+
+	static void* blocks[200000];
+	u32 numBlocks = 0;
+	while (allocator->numPagesUsed + 600 < size / allocator->pageSize) {
+		blocks[numBlocks++] = allocator->Allocate(3000, 128); // One page each, slabs don't serve this alignment
+	}
+	for (u32 i = 0; i < numBlocks; i += 3) {
+		allocator->Release(blocks[i]);
+		blocks[i] = 0;
+	}
+
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < Repeats; ++i) {
+		ReleaseLarge(allocator, allocator->Allocate(256 * 4096));
+	}
+	printf("fragmented,  %u pages: 256 page Allocate + Release %8.2f us\n", size / allocator->pageSize, MicrosecondsSince(start) / Repeats);
+
+	for (u32 i = 0; i < numBlocks; ++i) {
+		if (blocks[i] != 0) {
+			allocator->Release(blocks[i]);
+		}
+	}
+	Memory::Shutdown(allocator);
+}
+
+// 1 GiB heap (262143 pages) that is used up, except for a few runs at the very end
+static void NearlyFull(void* memory, u32 size) {
+	Memory::Allocator* allocator = Memory::Initialize(memory, size);
+
+	static void* blocks[8192];
+	u32 numBlocks = 0;
+	while (allocator->numPagesUsed + 64 * 4 + 8 < size / allocator->pageSize) {
+		blocks[numBlocks++] = allocator->Allocate(64 * 4096 - 64);
+	}
+
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < Repeats; ++i) {
+		ReleaseLarge(allocator, allocator->Allocate(200 * 4096));
+	}
+	printf("nearly full, %u pages: 200 page Allocate + Release %8.2f us\n", size / allocator->pageSize, MicrosecondsSince(start) / Repeats);
+
+	for (u32 i = 0; i < numBlocks; ++i) {
+		allocator->Release(blocks[i]);
+	}
+	Memory::Shutdown(allocator);
+}
+
+int main() {
+	u32 size = 1024u * 1024 * 1024 - 4096;
+	void* memory = malloc(size);
+	if (memory == 0) {
+		printf("Could not reserve memory for the benchmark\n");
+		return 1;
+	}
+
+	void* aligned = memory;
+	u32 alignedSize = 512u * 1024 * 1024;
+	Memory::AlignAndTrim(&aligned, &alignedSize);
+	Fragmented(aligned, alignedSize);
+
+	aligned = memory;
+	alignedSize = size;
+	Memory::AlignAndTrim(&aligned, &alignedSize);
+	NearlyFull(aligned, alignedSize);
+
+	free(memory);
+	return 0;
+}
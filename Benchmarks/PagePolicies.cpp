@@ -0,0 +1,113 @@
+#include "mem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+// Compares how the page allocation policies fragment the heap. build-linux.sh builds this once for every policy:
+// first fit, next fit (MEM_FIRST_FIT 0), MEM_BEST_FIT and MEM_TLSF, and every build runs the same workload. Random
+// slots are allocated and released over and over on a 64 MiB heap, most blocks take a few pages, some take up to
+// 512. Every 500 operations the page mask is read to find how fragmented the free pages are, that is one minus
+// the largest free run over all free pages. Reports the failed allocations, the average fragmentation, the highest
+// page that was ever used, peekPagesUsed and the time per allocation or release.
+
+static const u32 HeapSize = 64u * 1024 * 1024;
+static const u32 NumSlots = 384;
+static const u32 NumOperations = 400000;
+static const u32 SampleInterval = 500;
+
+// Blocks with this alignment are never served from a slab, so every block takes whole pages
+static const u32 PageAlignment = 128;
+
+static unsigned long long randomState = 88172645463325252ull;
+
+static u32 Random() {
+	randomState ^= randomState << 13;
+	randomState ^= randomState >> 7;
+	randomState ^= randomState << 17;
+	return (u32)(randomState >> 11);
+}
+
+static u32 PickPages() {
+	const u32 kind = Random() % 100;
+	if (kind < 60) {
+		return Random() % 8 + 1;
+	}
+	return kind < 90 ? Random() % 56 + 9 : Random() % 448 + 65;
+}
+
+// The page mask starts right after the allocator, one bit per page, set if the page is used
+static inline bool IsPageUsed(Memory::Allocator* allocator, u32 page) {
+	const u32* mask = (const u32*)((u8*)allocator + sizeof(Memory::Allocator));
+	return (mask[page / 32] & (1u << (page % 32))) != 0;
+}
+
+int main() {
+	u32 size = HeapSize + 4096;
+	void* memory = malloc(size);
+	if (memory == 0) {
+		printf("Could not reserve memory for the benchmark\n");
+		return 1;
+	}
+
+	void* aligned = memory;
+	Memory::AlignAndTrim(&aligned, &size);
+	Memory::Allocator* allocator = Memory::Initialize(aligned, size);
+	const u32 numPages = size / allocator->pageSize;
+
+	static void* slots[NumSlots];
+	u32 numFailed = 0;
+	u32 numSamples = 0;
+	u32 highestPage = 0;
+	double fragmentation = 0.0;
+	std::chrono::duration<double, std::nano> elapsed(0.0);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (u32 i = 0; i < NumOperations; ++i) {
+		const u32 slot = Random() % NumSlots;
+		if (slots[slot] != 0) {
+			allocator->Release(slots[slot]);
+			slots[slot] = 0;
+		}
+		else {
+			slots[slot] = allocator->Allocate(PickPages() * allocator->pageSize - 2 * PageAlignment, PageAlignment);
+			numFailed += slots[slot] == 0 ? 1 : 0;
+		}
+
+		// Sampling walks every page, it's left out of the time
+		if (i % SampleInterval == 0) {
+			elapsed += std::chrono::steady_clock::now() - start;
+			u32 numFree = 0;
+			u32 run = 0;
+			u32 largestRun = 0;
+			for (u32 page = 0; page < numPages; ++page) {
+				if (IsPageUsed(allocator, page)) {
+					highestPage = page > highestPage ? page : highestPage;
+					run = 0;
+				}
+				else {
+					numFree += 1;
+					run += 1;
+					largestRun = run > largestRun ? run : largestRun;
+				}
+			}
+			fragmentation += numFree != 0 ? 1.0 - (double)largestRun / (double)numFree : 0.0;
+			numSamples += 1;
+			start = std::chrono::steady_clock::now();
+		}
+	}
+	elapsed += std::chrono::steady_clock::now() - start;
+
+	for (u32 i = 0; i < NumSlots; ++i) {
+		if (slots[i] != 0) {
+			allocator->Release(slots[i]);
+		}
+	}
+
+	printf("%u pages: failed %u, fragmentation %.1f%%, highest page %u, peekPagesUsed %u, %.1f ns per operation\n",
+		numPages, numFailed, 100.0 * fragmentation / numSamples, highestPage, allocator->peekPagesUsed, elapsed.count() / NumOperations);
+
+	Memory::Shutdown(allocator);
+	free(memory);
+	return 0;
+}
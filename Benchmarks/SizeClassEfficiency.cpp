@@ -0,0 +1,97 @@
+#include "mem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// How much of the memory the allocator takes is used by the objects in it, with the size classes in MEM_SIZE_CLASSES.
+// build-linux.sh builds this with the default classes, and with the 64, 128, 256, 512, 1024 and 2048 byte bins the
+// sub-allocators used to have. Those bins kept a 24 byte header in every block, the classes don't, so the numbers of
+// the old bins are a best case. For each size mix 200k blocks are allocated, half of them are released, and half of
+// the free slots are allocated again. Reports the bytes that are still requested, the pages used and how many of the
+// bytes in those pages were requested.
+
+static const u32 NumBlocks = 200000;
+static const u32 NumMixes = 5;
+
+static const char* MixNames[NumMixes] = { "uniform 1-2000", "mostly small", "fixed 48", "fixed 16", "uniform 1-64" };
+
+static unsigned long long randomState = 88172645463325252ull;
+
+static u32 Random() {
+	randomState ^= randomState << 13;
+	randomState ^= randomState >> 7;
+	randomState ^= randomState << 17;
+	return (u32)(randomState >> 11);
+}
+
+static u32 PickSize(u32 mix) {
+	switch (mix) {
+	case 0: return Random() % 2000 + 1;
+	case 1: {
+		const u32 kind = Random() % 100;
+		if (kind < 70) {
+			return Random() % 57 + 8;
+		}
+		return kind < 95 ? Random() % 192 + 65 : Random() % 1744 + 257;
+	}
+	case 2: return 48;
+	case 3: return 16;
+	default: return Random() % 64 + 1;
+	}
+}
+
+int main() {
+	u32 size = 1024u * 1024 * 1024 + 4096;
+	void* memory = malloc(size);
+	if (memory == 0) {
+		printf("Could not reserve memory for the benchmark\n");
+		return 1;
+	}
+
+	void* aligned = memory;
+	Memory::AlignAndTrim(&aligned, &size);
+
+	static void* blocks[NumBlocks];
+	static u32 sizes[NumBlocks];
+	for (u32 mix = 0; mix < NumMixes; ++mix) {
+		randomState = 88172645463325252ull;
+		Memory::Allocator* allocator = Memory::Initialize(aligned, size);
+		const u32 pagesBefore = allocator->numPagesUsed;
+
+		unsigned long long live = 0;
+		for (u32 i = 0; i < NumBlocks; ++i) {
+			sizes[i] = PickSize(mix);
+			blocks[i] = allocator->Allocate(sizes[i]);
+			live += sizes[i];
+		}
+		for (u32 i = 0; i < NumBlocks; ++i) {
+			if (Random() % 2 == 0) {
+				allocator->Release(blocks[i]);
+				blocks[i] = 0;
+				live -= sizes[i];
+			}
+		}
+		for (u32 i = 0; i < NumBlocks; ++i) {
+			if (blocks[i] == 0 && Random() % 2 == 0) {
+				sizes[i] = PickSize(mix);
+				blocks[i] = allocator->Allocate(sizes[i]);
+				live += sizes[i];
+			}
+		}
+
+		const u32 pagesUsed = allocator->numPagesUsed - pagesBefore;
+		printf("%-15s %9.1f KiB requested, %6u pages, %5.1f%% of the page bytes requested\n", MixNames[mix], live / 1024.0,
+			pagesUsed, 100.0 * live / ((double)pagesUsed * allocator->pageSize));
+
+		for (u32 i = 0; i < NumBlocks; ++i) {
+			if (blocks[i] != 0) {
+				allocator->Release(blocks[i]);
+				blocks[i] = 0;
+			}
+		}
+		Memory::Shutdown(allocator);
+	}
+
+	free(memory);
+	return 0;
+}
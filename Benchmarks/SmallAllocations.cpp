@@ -0,0 +1,81 @@
+#include "mem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+// Small allocation fast path. 64 live blocks are released and allocated again, 20 million times. Ballast
+// allocations keep every slab half full, so each allocation is served from a free list and each release
+// pushes onto one. What's left is the cost of finding the size class and the free list operations.
+
+static const u32 NumLiveBlocks = 64;
+static const u32 NumBallastBlocks = 40000;
+static const u32 NumOperations = 20000000;
+static const u32 NumSizes = 1 << 16;
+
+static unsigned long long randomState = 88172645463325252ull;
+
+static u32 Random() {
+	randomState ^= randomState << 13;
+	randomState ^= randomState >> 7;
+	randomState ^= randomState << 17;
+	return (u32)(randomState >> 11);
+}
+
+static void Benchmark(void* memory, u32 size, u32 maxSize) {
+	Memory::Allocator* allocator = Memory::Initialize(memory, size);
+
+	static u32 sizes[NumSizes];
+	for (u32 i = 0; i < NumSizes; ++i) {
+		sizes[i] = Random() % maxSize + 1;
+	}
+
+	static void* ballast[NumBallastBlocks];
+	for (u32 i = 0; i < NumBallastBlocks; ++i) {
+		ballast[i] = allocator->Allocate(i % maxSize + 1);
+	}
+	for (u32 i = 0; i < NumBallastBlocks; i += 2) {
+		allocator->Release(ballast[i]);
+	}
+
+	void* blocks[NumLiveBlocks];
+	for (u32 i = 0; i < NumLiveBlocks; ++i) {
+		blocks[i] = allocator->Allocate(sizes[i]);
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (u32 i = 0; i < NumOperations; ++i) {
+		const u32 block = i % NumLiveBlocks;
+		allocator->Release(blocks[block]);
+		blocks[block] = allocator->Allocate(sizes[i % NumSizes]);
+	}
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	printf("sizes 1-%u: %6.1f ns per Release + Allocate\n", maxSize, elapsed.count() / NumOperations);
+
+	for (u32 i = 0; i < NumLiveBlocks; ++i) {
+		allocator->Release(blocks[i]);
+	}
+	for (u32 i = 1; i < NumBallastBlocks; i += 2) {
+		allocator->Release(ballast[i]);
+	}
+	Memory::Shutdown(allocator);
+}
+
+int main() {
+	u32 size = 64u * 1024 * 1024 + 4096;
+	void* memory = malloc(size);
+	if (memory == 0) {
+		printf("Could not reserve memory for the benchmark\n");
+		return 1;
+	}
+
+	void* aligned = memory;
+	u32 alignedSize = size;
+	Memory::AlignAndTrim(&aligned, &alignedSize);
+
+	Benchmark(aligned, alignedSize, 100);
+	Benchmark(aligned, alignedSize, 2000);
+
+	free(memory);
+	return 0;
+}
@@ -0,0 +1,161 @@
+#include "mem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <pthread.h>
+
+// Multi-threaded scalability, from 1 to 64 threads. Every thread keeps a few live allocations, and replaces a random
+// one over and over. The same number of operations is split between the threads, so perfect scaling shows up as the
+// operations per second going up with the thread count, until there are more threads than cores.
+// Without MEM_THREAD_SAFE every call is wrapped in one global mutex, which is what callers had to do before the thread
+// safe mode. After each run the contents of every block are checked, and requested has to be back at 0.
+// mem.h has its own placement new, so this uses pthreads instead of <thread> and <mutex>, which include <new>.
+
+static const u32 NumOperations = 4000000;
+static const u32 MaxThreads = 64;
+static const u32 NumModes = 5;
+
+static const char* ModeNames[NumModes] = { "same class", "class per thread", "mixed 1-2048", "mixed 1-64K", "large 16K-256K" };
+static const u32 ClassSizes[] = { 8, 16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072 };
+
+static Memory::Allocator* allocator = 0;
+static pthread_mutex_t globalMutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile bool failed = false;
+
+static void* Allocate(u32 bytes) {
+#if MEM_THREAD_SAFE
+	return allocator->Allocate(bytes);
+#else
+	pthread_mutex_lock(&globalMutex);
+	void* memory = allocator->Allocate(bytes);
+	pthread_mutex_unlock(&globalMutex);
+	return memory;
+#endif
+}
+
+static void Release(void* memory) {
+#if MEM_THREAD_SAFE
+	allocator->Release(memory);
+#else
+	pthread_mutex_lock(&globalMutex);
+	allocator->Release(memory);
+	pthread_mutex_unlock(&globalMutex);
+#endif
+}
+
+struct Random {
+	unsigned long long state;
+
+	u32 Next() {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		return (u32)(state >> 11);
+	}
+};
+
+static u32 PickSize(u32 mode, u32 thread, Random* random) {
+	switch (mode) {
+	case 0: return 64;
+	case 1: return ClassSizes[thread % (sizeof(ClassSizes) / sizeof(ClassSizes[0]))];
+	case 2: return random->Next() % 2048 + 1;
+	case 3: return random->Next() % 65536 + 1;
+	default: return random->Next() % 245760 + 16385;
+	}
+}
+
+// Every block starts with a value made from its address and the thread that owns it
+static void Stamp(void* memory, u32 thread) {
+	*(Memory::ptr_type*)memory = (Memory::ptr_type)memory ^ thread;
+}
+
+static void Check(void* memory, u32 thread) {
+	if (*(Memory::ptr_type*)memory != ((Memory::ptr_type)memory ^ thread)) {
+		failed = true;
+	}
+}
+
+struct WorkArgs {
+	u32 mode;
+	u32 thread;
+	u32 numOperations;
+};
+
+static void* Work(void* workArgs) {
+	const u32 mode = ((WorkArgs*)workArgs)->mode;
+	const u32 thread = ((WorkArgs*)workArgs)->thread;
+	const u32 numOperations = ((WorkArgs*)workArgs)->numOperations;
+	const u32 numLive = mode >= 3 ? 32 : 256; // Large modes keep fewer blocks alive, so 64 threads fit in the heap
+	void* live[256];
+	Random random = { 88172645463325252ull + thread * 7919ull };
+
+	for (u32 i = 0; i < numLive; ++i) {
+		live[i] = Allocate(PickSize(mode, thread, &random));
+		Stamp(live[i], thread);
+	}
+	for (u32 i = 0; i < numOperations; ++i) {
+		const u32 block = random.Next() % numLive;
+		Check(live[block], thread);
+		Release(live[block]);
+		live[block] = Allocate(PickSize(mode, thread, &random));
+		if (live[block] == 0) {
+			failed = true;
+			return 0;
+		}
+		Stamp(live[block], thread);
+	}
+	for (u32 i = 0; i < numLive; ++i) {
+		Check(live[i], thread);
+		Release(live[i]);
+	}
+#if MEM_THREAD_CACHE
+	allocator->FlushThreadCache();
+#endif
+	return 0;
+}
+
+int main() {
+	u32 size = 512u * 1024 * 1024 + 4096;
+	void* memory = malloc(size);
+	if (memory == 0) {
+		printf("Could not reserve memory for the benchmark\n");
+		return 1;
+	}
+
+	void* aligned = memory;
+	Memory::AlignAndTrim(&aligned, &size, 64);
+	allocator = Memory::Initialize(aligned, size);
+	const u32 pagesUsed = allocator->numPagesUsed;
+
+	printf("%s, Mops/s\n", MEM_THREAD_SAFE ? "MEM_THREAD_SAFE" : "global mutex");
+	for (u32 mode = 0; mode < NumModes; ++mode) {
+		printf("%-17s", ModeNames[mode]);
+		for (u32 numThreads = 1; numThreads <= MaxThreads; numThreads *= 2) {
+			pthread_t threads[MaxThreads];
+			WorkArgs args[MaxThreads];
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for (u32 i = 0; i < numThreads; ++i) {
+				args[i] = { mode, i, NumOperations / numThreads };
+				pthread_create(&threads[i], 0, Work, &args[i]);
+			}
+			for (u32 i = 0; i < numThreads; ++i) {
+				pthread_join(threads[i], 0);
+			}
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			printf(" %2uT %6.1f", numThreads, NumOperations / elapsed.count() / 1000000.0);
+			fflush(stdout);
+
+			allocator->Trim();
+			if (failed || allocator->Requested() != 0 || allocator->numPagesUsed != pagesUsed) {
+				printf("\nFailed: a block was corrupted, an allocation failed, or memory was not given back\n");
+				return 1;
+			}
+		}
+		printf("\n");
+	}
+
+	Memory::Shutdown(allocator);
+	free(memory);
+	return 0;
+}
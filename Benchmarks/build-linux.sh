@@ -0,0 +1,53 @@
+#!/bin/sh
+# Builds every benchmark into ./build. Each one gets its own copy of the library, with the compile flags that are
+# passed to build set in its mem.h. Extra compiler arguments can be passed to this script, like -fsanitize=thread.
+# mem.h knows the _WIN64, _WIN32 and _WASM32 platforms, 64 bit Linux builds as _WIN64. mem.cpp implements memset
+# and memcpy itself, so they can't be compiler builtins.
+set -e
+cd "$(dirname "$0")"
+
+# build <name> <source> [FLAG=VALUE ...]
+build() {
+    name=$1
+    source=$2
+    shift 2
+    mkdir -p build/$name
+    cp ../mem.h ../mem.cpp build/$name/
+    # Defines that go on over several lines are joined, so a flag replaces all of its value
+    sed -i -e ':a' -e '/\\$/{N;s/\\\n *//;ba}' build/$name/mem.h
+    for flag in "$@"; do
+        sed -i "s/^#define ${flag%%=*}\( .*\)\?$/#define ${flag%%=*} ${flag#*=}/" build/$name/mem.h
+    done
+    g++ -std=c++17 -O2 \
+        -D _WIN64=1 \
+        -D __cdecl= \
+        -fpermissive \
+        -w \
+        -fno-builtin \
+        -fno-delete-null-pointer-checks \
+        -fno-tree-loop-distribute-patterns \
+        -include sched.h \
+        -I build/$name \
+        $EXTRA_FLAGS \
+        -o build/$name/$name \
+        $source build/$name/mem.cpp \
+        -lpthread
+    echo "built build/$name/$name"
+}
+
+EXTRA_FLAGS="$*"
+
+build LargeAllocations LargeAllocations.cpp
+build LargeAllocations64 LargeAllocations.cpp MEM_TRACKING_UNIT_64=1
+build LargeAllocationsTLSF LargeAllocations.cpp MEM_TLSF=1
+build LargeAllocationsBestFit LargeAllocations.cpp MEM_BEST_FIT=1
+build SmallAllocations SmallAllocations.cpp
+build AlignedObjects AlignedObjects.cpp
+build SizeClassEfficiency SizeClassEfficiency.cpp
+build SizeClassEfficiencyOldBins SizeClassEfficiency.cpp "MEM_SIZE_CLASSES=64, 128, 256, 512, 1024, 2048"
+build PagePoliciesFirstFit PagePolicies.cpp
+build PagePoliciesNextFit PagePolicies.cpp MEM_FIRST_FIT=0
+build PagePoliciesBestFit PagePolicies.cpp MEM_BEST_FIT=1
+build PagePoliciesTLSF PagePolicies.cpp MEM_TLSF=1
+build Threads Threads.cpp
+build ThreadsSafe Threads.cpp MEM_THREAD_SAFE=1 "MEM_THREAD_YIELD()=sched_yield()"
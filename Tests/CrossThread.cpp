@@ -0,0 +1,120 @@
+#include "mem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+// Blocks released by another thread than the one that allocated them, meant to run under ThreadSanitizer. Threads
+// on four arenas allocate a block, and swap it into a random slot that all threads share. The block that was in the
+// slot is released, so most releases go to an arena the releasing thread isn't bound to, and to a thread cache that
+// holds blocks of other arenas. Most blocks are small, some take whole pages. After every round the contents of the
+// slots are checked, and once they are released requested has to be back at 0, and every page has to be free again.
+// mem.h has its own placement new, so this uses pthreads instead of <thread>, which includes <new>.
+
+static const u32 NumThreads = 6;
+static const u32 NumArenas = 4;
+static const u32 NumRounds = 3;
+static const u32 NumOperations = 100000;
+static const u32 NumSlots = 4096;
+
+static Memory::Allocator* allocator = 0;
+static void* slots[NumSlots];
+static volatile bool failed = false;
+
+struct Random {
+	unsigned long long state;
+
+	u32 Next() {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		return (u32)(state >> 11);
+	}
+};
+
+static u32 PickSize(Random* random) {
+	const u32 kind = random->Next() % 100;
+	if (kind < 90) {
+		return random->Next() % 2048 + 1;
+	}
+	return kind < 99 ? random->Next() % 40000 + 1 : random->Next() % 300000 + 1;
+}
+
+// Every block starts with its size, and ends with a value made from it
+static void Stamp(u8* memory, u32 bytes) {
+	*(u32*)memory = bytes;
+	memory[bytes - 1] = (u8)(bytes * 7);
+}
+
+static bool IsStamped(u8* memory) {
+	const u32 bytes = *(u32*)memory;
+	return bytes > sizeof(u32) && bytes <= 300000 + sizeof(u32) && memory[bytes - 1] == (u8)(bytes * 7);
+}
+
+static void* Work(void* thread) {
+	Random random = { 88172645463325252ull + (Memory::ptr_type)thread * 7919ull };
+
+	for (u32 i = 0; i < NumOperations / NumThreads; ++i) {
+		const u32 bytes = PickSize(&random) + sizeof(u32); // Room for the size
+		u8* memory = (u8*)allocator->Allocate(bytes);
+		if (memory == 0) {
+			failed = true;
+			return 0;
+		}
+		Stamp(memory, bytes);
+
+		void* old = __atomic_exchange_n(&slots[random.Next() % NumSlots], (void*)memory, __ATOMIC_ACQ_REL);
+		if (old != 0) {
+			if (!IsStamped((u8*)old)) {
+				failed = true;
+			}
+			allocator->Release(old);
+		}
+	}
+	return 0;
+}
+
+int main() {
+	u32 size = 1024u * 1024 * 1024;
+	void* memory = malloc(size + 4096);
+	if (memory == 0) {
+		printf("Could not reserve memory for the test\n");
+		return 1;
+	}
+
+	void* aligned = memory;
+	Memory::AlignAndTrim(&aligned, &size, 64);
+	allocator = Memory::Initialize(aligned, size, Memory::DefaultPageSize, NumArenas);
+	const u32 pagesUsed = allocator->numPagesUsed;
+
+	for (u32 round = 0; round < NumRounds; ++round) {
+		pthread_t threads[NumThreads];
+		for (u32 i = 0; i < NumThreads; ++i) {
+			pthread_create(&threads[i], 0, Work, (void*)(Memory::ptr_type)i);
+		}
+		for (u32 i = 0; i < NumThreads; ++i) {
+			pthread_join(threads[i], 0);
+		}
+		for (u32 i = 0; i < NumSlots; ++i) {
+			if (slots[i] != 0 && !IsStamped((u8*)slots[i])) {
+				failed = true;
+			}
+		}
+	}
+
+	for (u32 i = 0; i < NumSlots; ++i) {
+		if (slots[i] != 0) {
+			allocator->Release(slots[i]);
+		}
+	}
+	allocator->Trim();
+	const bool passed = !failed && allocator->Requested() == 0 && allocator->numPagesUsed == pagesUsed;
+	printf("cross thread      %s\n", passed ? "ok" : "FAILED");
+	if (!passed) {
+		return 1;
+	}
+
+	Memory::Shutdown(allocator);
+	free(memory);
+	return 0;
+}
@@ -0,0 +1,173 @@
+#include "mem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Memory::Debug::MemInfo on a single thread, meant to be built with every allocation header layout. Large blocks
+// with a header, and small blocks from the sub-allocators, are allocated, then MemInfo is read back. Every large
+// block has to be listed once under the active allocations, with its offset, size, alignment, first page and
+// location, and the small blocks have to add up. With MEM_TRACK_ACTIVE the list is walked, without it the page
+// descriptors are, and with MEM_COMPACT_HEADER the size, alignment and location come from the compact header and
+// the page descriptor. The dump is checked again after half the blocks are released, and after all of them are.
+
+static const u32 NumLarge = 300;
+static const u32 NumSmall = 2000;
+static const u32 NumAlignments = 5;
+static const u32 Alignments[NumAlignments] = { 0, 16, 64, 128, 256 };
+static const u32 MaxDump = 4 * 1024 * 1024;
+
+struct Large {
+	void* memory;
+	u32 size;
+	u32 alignment;
+	char location[32];
+	bool seen;
+};
+
+static Memory::Allocator* allocator = 0;
+static Large large[NumLarge];
+static void* small[NumSmall];
+static char dump[MaxDump];
+static u32 dumpSize = 0;
+static bool failed = false;
+
+#define CHECK(condition) if (!(condition)) { printf("    %s failed on line %d\n", #condition, __LINE__); failed = true; }
+
+static void Write(const u8* mem, u32 size, void* userdata) {
+	if (dumpSize + size < MaxDump) {
+		memcpy(dump + dumpSize, mem, size);
+		dumpSize += size;
+		dump[dumpSize] = 0;
+	}
+	else {
+		failed = true;
+	}
+}
+
+static Large* FindLarge(u32 size) {
+	for (u32 i = 0; i < NumLarge; ++i) {
+		if (large[i].memory != 0 && large[i].size == size) {
+			return &large[i];
+		}
+	}
+	return 0;
+}
+
+// Reads the active allocations and the small allocations out of the dump
+static void CheckDump(const char* name, u32 numLarge, u32 numSmall) {
+	dumpSize = 0;
+	dump[0] = 0;
+	Memory::Debug::MemInfo(allocator, Write);
+	for (u32 i = 0; i < NumLarge; ++i) {
+		large[i].seen = false;
+	}
+
+	const char* active = strstr(dump, "\nActive allocations:\n");
+	CHECK(active != 0);
+	u32 numListed = 0;
+	for (const char* line = active != 0 ? strchr(active + 1, '\n') + 1 : ""; *line == '\t'; line = strchr(line, '\n') + 1) {
+		u32 offset = 0, size = 0, padded = 0, alignment = 0, firstPage = 0;
+		CHECK(sscanf(line, "\t%u, size: %u, padded: %u, alignment: %u, first page: %u", &offset, &size, &padded, &alignment, &firstPage) == 5);
+		const char* location = strstr(line, ", location: ");
+		const char* end = strchr(line, '\n');
+		CHECK(location != 0 && end != 0 && location < end);
+		if (location == 0 || end == 0) {
+			break;
+		}
+		location += strlen(", location: ");
+
+		Large* block = FindLarge(size);
+		CHECK(block != 0 && !block->seen);
+		if (block != 0) {
+			block->seen = true;
+			CHECK(alignment == block->alignment);
+			CHECK(firstPage == offset / allocator->pageSize);
+			CHECK(offset + sizeof(Memory::Allocation) <= (u32)((u8*)block->memory - (u8*)allocator));
+			CHECK((u32)((u8*)block->memory - (u8*)allocator) - offset < sizeof(Memory::Allocation) + (alignment != 0 ? alignment : 1));
+#if MEM_TRACK_LOCATION
+			CHECK((u32)(end - location) == strlen(block->location) && strncmp(location, block->location, end - location) == 0);
+#else
+			CHECK(strncmp(location, "null\n", 5) == 0);
+#endif
+		}
+		numListed += 1;
+	}
+	CHECK(numListed == numLarge);
+
+	u32 numSmallListed = 0;
+	const char* smallAllocations = strstr(dump, "\nSmall allocations:\n");
+	if (smallAllocations != 0) {
+		for (const char* line = strchr(smallAllocations + 1, '\n') + 1; *line == '\t'; line = strchr(line, '\n') + 1) {
+			u32 blockSize = 0, used = 0;
+			CHECK(sscanf(line, "\t%u byte blocks: %u used", &blockSize, &used) == 2);
+			numSmallListed += used;
+		}
+	}
+	CHECK(numSmallListed == numSmall);
+
+	printf("%-17s %s\n", name, failed ? "FAILED" : "ok");
+}
+
+int main() {
+	u32 size = 64u * 1024 * 1024 + 4096;
+	void* memory = malloc(size);
+	if (memory == 0) {
+		printf("Could not reserve memory for the test\n");
+		return 1;
+	}
+
+	void* aligned = memory;
+	Memory::AlignAndTrim(&aligned, &size, 64);
+	allocator = Memory::Initialize(aligned, size);
+	const u32 pagesUsed = allocator->numPagesUsed;
+
+	// Every large block has its own size, so it can be found in the dump. Sizes above the largest size class, or an
+	// alignment above 64, skip the sub-allocators.
+	for (u32 i = 0; i < NumLarge; ++i) {
+		large[i].alignment = Alignments[i % NumAlignments];
+		large[i].size = large[i].alignment > 64 ? 100 + i * 13 : Memory::SizeClasses[Memory::NumSizeClasses - 1] + 1 + i * 13;
+		snprintf(large[i].location, sizeof(large[i].location), "Tests/MemInfo.cpp:large %u", i);
+		large[i].memory = allocator->Allocate(large[i].size, large[i].alignment, large[i].location);
+		CHECK(large[i].memory != 0);
+		CHECK(large[i].alignment == 0 || (Memory::ptr_type)large[i].memory % large[i].alignment == 0);
+	}
+	for (u32 i = 0; i < NumSmall; ++i) {
+		small[i] = allocator->Allocate(i % 500 + 1, 0, "Tests/MemInfo.cpp:small");
+		CHECK(small[i] != 0);
+	}
+	CheckDump("all live", NumLarge, NumSmall);
+
+	for (u32 i = 0; i < NumLarge; i += 2) {
+		allocator->Release(large[i].memory);
+		large[i].memory = 0;
+	}
+	for (u32 i = 0; i < NumSmall; i += 2) {
+		allocator->Release(small[i]);
+		small[i] = 0;
+	}
+	CheckDump("half released", NumLarge / 2, NumSmall / 2);
+
+	for (u32 i = 0; i < NumLarge; ++i) {
+		if (large[i].memory != 0) {
+			allocator->Release(large[i].memory);
+			large[i].memory = 0;
+		}
+	}
+	for (u32 i = 0; i < NumSmall; ++i) {
+		if (small[i] != 0) {
+			allocator->Release(small[i]);
+		}
+	}
+	CheckDump("all released", 0, 0);
+
+	allocator->Trim();
+	CHECK(allocator->Requested() == 0 && allocator->numPagesUsed == pagesUsed);
+	if (failed) {
+		return 1;
+	}
+
+	Memory::Shutdown(allocator);
+	free(memory);
+	return 0;
+}
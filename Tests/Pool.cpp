@@ -0,0 +1,242 @@
+#include "mem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Memory::Pool on a single thread. Objects count how many of them are alive, so every test can check that New ran
+// the constructor and Delete the destructor. Covers New with and without arguments, Delete, NewArray and
+// DeleteArray, DeleteAll, Clear, over-aligned types and a type that only fits a few times in a page. ForEach is
+// checked against the objects the test knows are alive, and with a callback that deletes every other object it's
+// given, which has to work because ForEach finds objects from the live bits of each page. After every test Clear
+// has to give every page back, and requested has to be back at 0.
+
+static const u32 NumObjects = 20000;
+static const u32 NumOperations = 100000;
+
+static Memory::Allocator* allocator = 0;
+static int numAlive = 0;
+static bool failed = false;
+
+#define CHECK(condition) if (!(condition)) { printf("    %s failed on line %d\n", #condition, __LINE__); failed = true; }
+
+struct Random {
+	unsigned long long state;
+
+	u32 Next() {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		return (u32)(state >> 11);
+	}
+};
+
+struct Particle {
+	float position[3];
+	float velocity[3];
+	u32 id;
+
+	Particle() : position{}, velocity{}, id(0) { ++numAlive; }
+	Particle(u32 _id) : position{}, velocity{}, id(_id) { ++numAlive; }
+	Particle(u32 _id, float x, float y) : position{ x, y, 0.0f }, velocity{}, id(_id) { ++numAlive; }
+	~Particle() { --numAlive; }
+};
+
+struct alignas(64) Body {
+	float world[16];
+	u32 id;
+
+	Body() : world{}, id(0) { ++numAlive; }
+	Body(u32 _id) : world{}, id(_id) { ++numAlive; }
+	~Body() { --numAlive; }
+};
+
+struct alignas(256) Cell {
+	u32 id;
+
+	Cell() : id(0) { ++numAlive; }
+	Cell(u32 _id) : id(_id) { ++numAlive; }
+	~Cell() { --numAlive; }
+};
+
+// Only three of these fit in a 4 KiB page, next to the live mask
+struct Big {
+	u8 bytes[1300];
+	u32 id;
+
+	Big() : id(0) { ++numAlive; }
+	Big(u32 _id) : id(_id) { ++numAlive; }
+	~Big() { --numAlive; }
+};
+
+// The objects the test knows are alive, objects[i] has the id i
+static void* objects[NumObjects];
+static u32 numVisited = 0;
+
+template<class T>
+static bool IsAligned(T* object) {
+	return (Memory::ptr_type)object % alignof(T) == 0;
+}
+
+// ForEach has to visit every live object once, with the id it was made with
+template<class T>
+static void CheckForEach(Memory::Pool<T>* pool, u32 numLive) {
+	numVisited = 0;
+	bool wrong = false;
+	pool->ForEach([&wrong](T* object) {
+		wrong = wrong || object->id >= NumObjects || objects[object->id] != object;
+		numVisited += 1;
+	});
+	CHECK(!wrong);
+	CHECK(numVisited == numLive);
+	CHECK(pool->Count() == numLive);
+}
+
+template<class T>
+static void Test(const char* name, u32 pagesPerChunk) {
+	const u32 pagesUsed = allocator->numPagesUsed;
+	const bool wasFailed = failed;
+	failed = false;
+	numAlive = 0;
+	for (u32 i = 0; i < NumObjects; ++i) {
+		objects[i] = 0;
+	}
+
+	{
+		Memory::Pool<T> pool(allocator, pagesPerChunk);
+		CHECK(pool.Count() == 0 && pool.Capacity() == 0);
+
+		// New and Delete, random objects are deleted and made again
+		Random random = { 88172645463325252ull };
+		u32 numLive = 0;
+		for (u32 i = 0; i < NumOperations; ++i) {
+			const u32 id = random.Next() % NumObjects;
+			if (objects[id] != 0) {
+				CHECK(((T*)objects[id])->id == id);
+				pool.Delete((T*)objects[id]);
+				objects[id] = 0;
+				numLive -= 1;
+			}
+			else {
+				T* object = pool.New(id);
+				CHECK(object != 0 && IsAligned(object));
+				objects[id] = object;
+				numLive += 1;
+			}
+		}
+		CHECK(numAlive == (int)numLive);
+		CheckForEach(&pool, numLive);
+
+		// A callback that deletes the object it was given, every other one
+		u32 numDeleted = 0;
+		pool.ForEach([&pool, &numDeleted](T* object) {
+			if (object->id % 2 == 0) {
+				objects[object->id] = 0;
+				pool.Delete(object);
+				numDeleted += 1;
+			}
+		});
+		numLive -= numDeleted;
+		CHECK(numAlive == (int)numLive);
+		CheckForEach(&pool, numLive);
+
+		// DeleteAll keeps the chunks, making the same number of objects again doesn't need new pages
+		const u32 capacity = pool.Capacity();
+		const u32 pagesWithChunks = allocator->numPagesUsed;
+		pool.DeleteAll();
+		CHECK(numAlive == 0 && pool.Count() == 0 && pool.Capacity() == capacity);
+		for (u32 i = 0; i < NumObjects; ++i) {
+			objects[i] = 0;
+		}
+		CheckForEach(&pool, 0);
+
+		// NewArray and DeleteArray
+		T* array[NumObjects];
+		CHECK(pool.NewArray(array, NumObjects) == NumObjects);
+		CHECK(numAlive == (int)NumObjects && pool.Count() == NumObjects);
+		for (u32 i = 0; i < NumObjects; ++i) {
+			CHECK(array[i] != 0 && IsAligned(array[i]) && array[i]->id == 0);
+			array[i]->id = i;
+			objects[i] = array[i];
+		}
+		CheckForEach(&pool, NumObjects);
+		if (pool.Capacity() == capacity) {
+			CHECK(allocator->numPagesUsed == pagesWithChunks);
+		}
+		pool.DeleteArray(array, NumObjects / 2);
+		for (u32 i = 0; i < NumObjects / 2; ++i) {
+			objects[i] = 0;
+		}
+		CHECK(numAlive == (int)(NumObjects - NumObjects / 2));
+		CheckForEach(&pool, NumObjects - NumObjects / 2);
+
+		// Clear destroys the rest, and gives the chunks back
+		pool.Clear();
+		CHECK(numAlive == 0 && pool.Count() == 0 && pool.Capacity() == 0);
+		CHECK(allocator->numPagesUsed == pagesUsed);
+
+		// The pool can be used again after Clear, the destructor clears it
+		for (u32 i = 0; i < 100; ++i) {
+			CHECK(pool.New(i) != 0);
+		}
+	}
+	CHECK(numAlive == 0);
+	CHECK(allocator->Requested() == 0);
+	CHECK(allocator->numPagesUsed == pagesUsed);
+
+	printf("%-17s %s\n", name, failed ? "FAILED" : "ok");
+	failed = failed || wasFailed;
+}
+
+// New with two and three arguments, and Delete of 0
+static void TestArguments() {
+	const bool wasFailed = failed;
+	failed = false;
+	numAlive = 0;
+	{
+		Memory::Pool<Particle> pool(allocator);
+		Particle* a = pool.New(7u, 1.0f, 2.0f);
+		Particle* b = pool.New(8u, 3.0f, 4.0f, "Tests/Pool.cpp");
+		CHECK(a != 0 && a->id == 7 && a->position[0] == 1.0f && a->position[1] == 2.0f);
+		CHECK(b != 0 && b->id == 8 && b->position[0] == 3.0f && b->position[1] == 4.0f);
+		pool.Delete((Particle*)0);
+		CHECK(numAlive == 2 && pool.Count() == 2);
+		pool.Delete(a);
+		CHECK(numAlive == 1 && pool.Count() == 1);
+	}
+	CHECK(numAlive == 0);
+	CHECK(allocator->Requested() == 0);
+
+	printf("%-17s %s\n", "arguments", failed ? "FAILED" : "ok");
+	failed = failed || wasFailed;
+}
+
+int main() {
+	u32 size = 256u * 1024 * 1024 + 4096;
+	void* memory = malloc(size);
+	if (memory == 0) {
+		printf("Could not reserve memory for the test\n");
+		return 1;
+	}
+
+	void* aligned = memory;
+	Memory::AlignAndTrim(&aligned, &size, 64);
+	allocator = Memory::Initialize(aligned, size);
+	const u32 pagesUsed = allocator->numPagesUsed;
+
+	Test<Particle>("particle", 16);
+	Test<Particle>("one page chunks", 1);
+	Test<Body>("aligned 64", 16);
+	Test<Cell>("aligned 256", 4);
+	Test<Big>("three per page", 8);
+	TestArguments();
+
+	allocator->Trim();
+	CHECK(allocator->Requested() == 0 && allocator->numPagesUsed == pagesUsed);
+	if (failed) {
+		return 1;
+	}
+
+	Memory::Shutdown(allocator);
+	free(memory);
+	return 0;
+}
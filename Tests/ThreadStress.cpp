@@ -0,0 +1,211 @@
+#include "mem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <time.h>
+
+// Multi-threaded stress test, meant to run under ThreadSanitizer. Threads on three arenas keep live blocks, and
+// replace a random one over and over, with one size class, a size class per thread, mixed small sizes, mixed sizes
+// up to 64 KiB and large sizes. Every block is stamped, and checked before it's released. After each run requested
+// has to be back at 0, and every page has to be free again.
+// The nearly full run fills the heap until there is only one free page per thread left. Every thread holds one page
+// at a time, and replaces it, so there is always a free page for the next one, and no allocation is allowed to fail.
+// The pressure run fills the heap except for one two page slot per thread, spread out over all of it. Threads hold
+// one two page block at a time, so there is always a free slot, but it's often one that a search already went past.
+// A timer makes the running thread sleep every 100 microseconds, so threads are paused in the middle of a search
+// while the others release and claim slots, even on a single core. With MEM_LOCK_FREE_PAGES those searches miss,
+// and have to be tried again, a miss that is reported as a failure is a bug.
+// mem.h has its own placement new, so this uses pthreads instead of <thread>, which includes <new>.
+
+static const u32 NumThreads = 8;
+static const u32 NumArenas = 3;
+static const u32 NumOperations = 200000;
+static const u32 NumModes = 7;
+static const u32 NearlyFull = 5;
+static const u32 Pressure = 6;
+static const u32 MaxFill = 16384;
+
+static const char* ModeNames[NumModes] = { "same class", "class per thread", "mixed 1-2048", "mixed 1-64K", "large 16K-256K", "nearly full", "pressure" };
+static const u32 ClassSizes[] = { 8, 16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072 };
+
+static Memory::Allocator* allocator = 0;
+static volatile bool failed = false;
+
+struct Random {
+	unsigned long long state;
+
+	u32 Next() {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		return (u32)(state >> 11);
+	}
+};
+
+// Blocks with this alignment are never served from a slab, the last two runs use them to take whole pages
+static const u32 PageAlignment = 128;
+
+static u32 PickSize(u32 mode, u32 thread, Random* random) {
+	switch (mode) {
+	case 0: return 64;
+	case 1: return ClassSizes[thread % (sizeof(ClassSizes) / sizeof(ClassSizes[0]))];
+	case 2: return random->Next() % 2048 + 1;
+	case 3: return random->Next() % 65536 + 1;
+	case 4: return random->Next() % 245760 + 16385;
+	case NearlyFull: return allocator->pageSize - 2 * PageAlignment; // One page, with room for the header and the padding
+	default: return 2 * allocator->pageSize - 2 * PageAlignment;
+	}
+}
+
+static u32 NumLive(u32 mode) {
+	return mode >= NearlyFull ? 1 : (mode >= 3 ? 32 : 256);
+}
+
+// Every block starts with a value made from its address and the thread that owns it
+static void Stamp(void* memory, u32 thread) {
+	*(Memory::ptr_type*)memory = (Memory::ptr_type)memory ^ thread;
+}
+
+static void Check(void* memory, u32 thread) {
+	if (*(Memory::ptr_type*)memory != ((Memory::ptr_type)memory ^ thread)) {
+		failed = true;
+	}
+}
+
+struct WorkArgs {
+	u32 mode;
+	u32 thread;
+};
+
+static void* Work(void* workArgs) {
+	const u32 mode = ((WorkArgs*)workArgs)->mode;
+	const u32 thread = ((WorkArgs*)workArgs)->thread;
+	const u32 numLive = NumLive(mode);
+	void* live[256];
+	Random random = { 88172645463325252ull + thread * 7919ull };
+
+	const u32 alignment = mode >= NearlyFull ? PageAlignment : 0;
+	for (u32 i = 0; i < numLive; ++i) {
+		live[i] = allocator->Allocate(PickSize(mode, thread, &random), alignment);
+		if (live[i] == 0) {
+			failed = true;
+			return 0;
+		}
+		Stamp(live[i], thread);
+	}
+	for (u32 i = 0; i < NumOperations / NumThreads; ++i) {
+		const u32 block = random.Next() % numLive;
+		Check(live[block], thread);
+		allocator->Release(live[block]);
+		live[block] = allocator->Allocate(PickSize(mode, thread, &random), alignment);
+		if (live[block] == 0) {
+			failed = true;
+			return 0;
+		}
+		Stamp(live[block], thread);
+	}
+	for (u32 i = 0; i < numLive; ++i) {
+		Check(live[i], thread);
+		allocator->Release(live[i]);
+	}
+	return 0;
+}
+
+// Sleeping gives up the core wherever the thread was, often in the middle of a page search
+static void Preempt(int) {
+	const int savedErrno = errno;
+	timespec pause = { 0, 1000 };
+	nanosleep(&pause, 0);
+	errno = savedErrno;
+}
+
+static void SetPreemptTimer(long microseconds) {
+	itimerval timer = { { 0, microseconds }, { 0, microseconds } };
+	setitimer(ITIMER_REAL, &timer, 0);
+}
+
+static bool Run(void* memory, u32 size, u32 mode) {
+	allocator = Memory::Initialize(memory, size, Memory::DefaultPageSize, NumArenas);
+	const u32 pagesUsed = allocator->numPagesUsed;
+
+	// Both full runs take every page with one page blocks first
+	static void* fill[MaxFill];
+	u32 numFill = 0;
+	const u32 keepFree = mode == NearlyFull ? NumThreads : 0;
+	while (mode >= NearlyFull && allocator->numPagesFree > keepFree && numFill < MaxFill) {
+		fill[numFill++] = allocator->Allocate(allocator->pageSize - 2 * PageAlignment, PageAlignment);
+	}
+	if (mode >= NearlyFull && allocator->numPagesFree != keepFree) {
+		failed = true; // Every fill block has to take exactly one page
+	}
+
+	// The pressure run gives back one two page slot per thread. Slots start on an even page, so they are buddy blocks.
+	if (mode == Pressure) {
+		const u32 spacing = (size / allocator->pageSize - pagesUsed) / NumThreads;
+		for (u32 i = 0; i < numFill; ++i) {
+			const u32 page = (u32)((u8*)fill[i] - (u8*)allocator) / allocator->pageSize;
+			const u32 slot = (pagesUsed + (page - pagesUsed) / spacing * spacing + spacing / 2) & ~1u;
+			if (page == slot || page == slot + 1) {
+				allocator->Release(fill[i]);
+				fill[i] = 0;
+			}
+		}
+		signal(SIGALRM, Preempt);
+		SetPreemptTimer(100);
+	}
+
+	pthread_t threads[NumThreads];
+	WorkArgs args[NumThreads];
+	for (u32 i = 0; i < NumThreads; ++i) {
+		args[i] = { mode, i };
+		pthread_create(&threads[i], 0, Work, &args[i]);
+	}
+	for (u32 i = 0; i < NumThreads; ++i) {
+		pthread_join(threads[i], 0);
+	}
+	SetPreemptTimer(0);
+
+	for (u32 i = 0; i < numFill; ++i) {
+		if (fill[i] != 0) {
+			allocator->Release(fill[i]);
+		}
+	}
+	allocator->Trim();
+	const bool passed = !failed && allocator->Requested() == 0 && allocator->numPagesUsed == pagesUsed;
+	printf("%-17s %s\n", ModeNames[mode], passed ? "ok" : "FAILED");
+	if (passed) {
+		Memory::Shutdown(allocator);
+	}
+	return passed;
+}
+
+int main() {
+	u32 size = 512u * 1024 * 1024 + 4096;
+	void* memory = malloc(size);
+	if (memory == 0) {
+		printf("Could not reserve memory for the test\n");
+		return 1;
+	}
+
+	void* aligned = memory;
+	Memory::AlignAndTrim(&aligned, &size, 64);
+	for (u32 mode = 0; mode < NearlyFull; ++mode) {
+		if (!Run(aligned, size, mode)) {
+			return 1;
+		}
+	}
+
+	if (!Run(aligned, 256 * Memory::DefaultPageSize, NearlyFull)) {
+		return 1;
+	}
+	if (!Run(aligned, MaxFill * Memory::DefaultPageSize, Pressure)) {
+		return 1;
+	}
+
+	free(memory);
+	return 0;
+}
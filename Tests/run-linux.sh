@@ -0,0 +1,66 @@
+#!/bin/sh
+# Builds every test into ./build with ThreadSanitizer and the debug checks on, and runs it. Each one gets its own copy
+# of the library, with the compile flags that are passed to build set in its mem.h, even flags that mem.h defines
+# inside of an #if, like MEM_TRACK_ACTIVE. Stops at the first test that fails, or that ThreadSanitizer reports a race
+# in. Extra compiler arguments can be passed to this script.
+# mem.h knows the _WIN64, _WIN32 and _WASM32 platforms, 64 bit Linux builds as _WIN64. mem.cpp implements memset
+# and memcpy itself, so they can't be compiler builtins.
+set -e
+cd "$(dirname "$0")"
+
+# run <name> <source> [FLAG=VALUE ...]
+run() {
+    name=$1
+    source=$2
+    shift 2
+    mkdir -p build/$name
+    cp ../mem.h ../mem.cpp build/$name/
+    for flag in "$@"; do
+        sed -i "s/^\([[:space:]]*\)#define ${flag%%=*}\( .*\)\?$/\1#define ${flag%%=*} ${flag#*=}/" build/$name/mem.h
+    done
+    g++ -std=c++17 -O1 -g \
+        -D _WIN64=1 \
+        -D __cdecl= \
+        -D _DEBUG=1 \
+        -fpermissive \
+        -w \
+        -fno-builtin \
+        -fno-delete-null-pointer-checks \
+        -fno-tree-loop-distribute-patterns \
+        -fsanitize=thread \
+        -include sched.h \
+        -I build/$name \
+        $EXTRA_FLAGS \
+        -o build/$name/$name \
+        $source build/$name/mem.cpp \
+        -lpthread
+    echo "$name"
+    TSAN_OPTIONS="halt_on_error=1 $TSAN_OPTIONS" build/$name/$name
+}
+
+EXTRA_FLAGS="$*"
+SAFE="MEM_THREAD_SAFE=1 MEM_THREAD_YIELD()=sched_yield()"
+
+run ThreadStress ThreadStress.cpp $SAFE
+run ThreadStressCache ThreadStress.cpp $SAFE MEM_THREAD_CACHE=1
+run ThreadStressLockFree ThreadStress.cpp $SAFE MEM_LOCK_FREE_PAGES=1
+run ThreadStressLockFreeNextFit ThreadStress.cpp $SAFE MEM_LOCK_FREE_PAGES=1 MEM_FIRST_FIT=0
+run ThreadStressLockFree64 ThreadStress.cpp $SAFE MEM_LOCK_FREE_PAGES=1 MEM_TRACKING_UNIT_64=1 MEM_THREAD_CACHE=1
+run ThreadStressTLSF ThreadStress.cpp $SAFE MEM_TLSF=1
+run ThreadStressBuddy ThreadStress.cpp $SAFE MEM_BUDDY=1
+run ThreadStressCompactHeader ThreadStress.cpp $SAFE MEM_COMPACT_HEADER=1
+run CrossThread CrossThread.cpp $SAFE
+run CrossThreadCache CrossThread.cpp $SAFE MEM_THREAD_CACHE=1
+run CrossThreadLockFree CrossThread.cpp $SAFE MEM_LOCK_FREE_PAGES=1 MEM_THREAD_CACHE=1
+run CrossThreadNoActive CrossThread.cpp $SAFE MEM_TRACK_ACTIVE=0
+run CrossThreadCompactHeader CrossThread.cpp $SAFE MEM_COMPACT_HEADER=1 MEM_THREAD_CACHE=1
+run Pool Pool.cpp
+run PoolCompactHeader Pool.cpp MEM_COMPACT_HEADER=1
+run PoolNoSuballocators Pool.cpp MEM_USE_SUBALLOCATORS=0
+run PoolThreadSafe Pool.cpp $SAFE
+run MemInfo MemInfo.cpp
+run MemInfoNoActive MemInfo.cpp MEM_TRACK_ACTIVE=0
+run MemInfoNoActiveNoLocation MemInfo.cpp MEM_TRACK_ACTIVE=0 MEM_TRACK_LOCATION=0
+run MemInfoCompactHeader MemInfo.cpp MEM_COMPACT_HEADER=1
+run MemInfoCompactHeaderNoLocation MemInfo.cpp MEM_COMPACT_HEADER=1 MEM_TRACK_LOCATION=0
+echo "all tests passed"
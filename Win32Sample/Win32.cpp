@@ -58,6 +58,17 @@ namespace Memory {
 	Allocator* GlobalAllocator = 0;
 }
 
+// Small allocations don't have a header, so they are not in the active list of the allocator.
+// The sample keeps track of the memory that's allocated trough the UI on its own.
+struct SampleAllocation {
+	void* memory;
+	u32 bytes;
+};
+
+#define MAX_SAMPLE_ALLOCATIONS 4096
+SampleAllocation gAllocations[MAX_SAMPLE_ALLOCATIONS];
+u32 gNumAllocations;
+
 struct MemoryDebugInfo {
 	u8* PageMask;
 	u32 NumberOfPages;
@@ -78,33 +89,17 @@ struct MemoryDebugInfo {
 
 		NumberOfPages = allocator->size / allocator->pageSize; // 1 page = 4096 bytes, how many are needed
 		WinAssert(allocator->size % allocator->pageSize == 0); // Allocator size should line up with page size
-		
-		u32 maskSize = AllocatorPageMaskSize(allocator) / (sizeof(u32) / sizeof(u8)); // convert from u8 to u32
-		u32 metaDataSizeBytes = AllocatorPaddedSize() + (maskSize * sizeof(u32));
-		u32 numberOfMasksUsed = metaDataSizeBytes / allocator->pageSize;
-		if (metaDataSizeBytes % allocator->pageSize != 0) {
-			numberOfMasksUsed += 1;
-		}
-		metaDataSizeBytes = numberOfMasksUsed * allocator->pageSize; // This way, allocatable will start on a page boundary
-
-		// Account for meta data
-		metaDataSizeBytes += allocator->pageSize;
-		numberOfMasksUsed += 1;
-
-		u32 allocatorOverheadBytes = metaDataSizeBytes;
-		WinAssert(allocatorOverheadBytes % allocator->pageSize == 0); // Offset to allocatable should always line up with page size
 
 		NumFreePages = 0;
 		NumUsedPages = 0;
-		NumOverheadPages = allocatorOverheadBytes / allocator->pageSize; // No need for a +1 padding allocatorOverheadBytes should be aligned to Memory::PageSize
-		//NumOverheadPages += 1; // Debug tracker page
+		NumOverheadPages = Memory::Debug::NumOverheadPages(allocator); // Header, page mask, summary mask and debug page
 
-		u32* mask = (u32*)PageMask;
+		Memory::TrackingUnit* mask = (Memory::TrackingUnit*)PageMask;
 		for (u32 page = NumOverheadPages; page < NumberOfPages; ++page) { // Don't start at page 0?
 			const u32 block = page / Memory::TrackingUnitSize;
 			const int bit = page % Memory::TrackingUnitSize;
 
-			const bool used = mask[block] & (1 << bit);
+			const bool used = mask[block] & ((Memory::TrackingUnit)1 << bit);
 			if (!used) {
 				NumFreePages += 1;
 			}
@@ -117,23 +112,6 @@ struct MemoryDebugInfo {
 		WinAssert(NumFreePages + NumUsedPages + NumOverheadPages == NumberOfPages);// Page number does not add up
 		WinAssert(NumUsedPages + NumOverheadPages == allocator->numPagesUsed);// Added up wrong number of used pages?!!
 	}
-private:
-	inline u32 AllocatorPageMaskSize(Memory::Allocator* allocator) { // This is the number of u8's that make up the AllocatorPageMask array
-		u32 allocatorNumberOfPages = allocator->size / allocator->pageSize; // 1 page = 4096 bytes, how many are needed
-		//assert(allocator->size % PageSize == 0, "Allocator size should line up with page size");
-		// allocatorNumberOfPages is the number of bits that are required to track memory
-
-		// Pad out to sizeof(32) (if MaskTrackerSize is 32). This is because AllocatorPageMask will often be used as a u32 array
-		// and we want to make sure that enough space is reserved.
-		u32 allocatorPageArraySize = allocatorNumberOfPages / Memory::TrackingUnitSize + (allocatorNumberOfPages % Memory::TrackingUnitSize ? 1 : 0);
-		//assert(allocatorPageArraySize % (TrackingUnitSize / 8) == 0, "allocatorPageArraySize should always be a multiple of 8");
-		return allocatorPageArraySize * (Memory::TrackingUnitSize / 8); // In bytes, not bits
-	}
-
-	inline u32 AllocatorPaddedSize() {
-		u32 allocatorHeaderSize = sizeof(Memory::Allocator);
-		return allocatorHeaderSize;
-	}
 };
 
 struct Win32Color {
@@ -330,11 +308,12 @@ void SetWindowLayout(const Win32WindowLayout& layout, HWND chart, HWND* labels,
 	wsprintfW(displaybuffer, L"Pages: %d free, %d used, %d overhead", memInfo.NumFreePages, memInfo.NumUsedPages, memInfo.NumOverheadPages);
 	SetWindowText(labels[1], displaybuffer);
 
-	kib = allocator->requested / 1024;
+	u32 requested = allocator->Requested();
+	kib = requested / 1024;
 	mib = kib / 1024;// + (kib % 1024 ? 1 : 0);
-	//kib = allocator->requested / 1024 + (allocator->requested % 1024 ? 1 : 0);
+	//kib = requested / 1024 + (requested % 1024 ? 1 : 0);
 
-	wsprintfW(displaybuffer, L"Requested: %d bytes (~%d MiB)", allocator->requested, mib);
+	wsprintfW(displaybuffer, L"Requested: %d bytes (~%d MiB)", requested, mib);
 	SetWindowText(labels[2], displaybuffer);
 
 	kib = (memInfo.NumUsedPages * allocator->pageSize) / 1024;
@@ -394,35 +373,10 @@ void ResetListBoxContent(Memory::Allocator* allocator, HWND list) {
 	SendMessage(list, LB_RESETCONTENT, 0, 0);
 
 	wchar_t displaybuffer[1024];
-	for (Memory::Allocation* iter = allocator->active; iter != 0; iter = (iter->nextOffset == 0) ? 0 : (Memory::Allocation*)((u8*)allocator + iter->nextOffset)) {
-		size_t len = 1; // To account for '\0' at the end of the string.
-		char* it = 0;
-#if MEM_TRACK_LOCATION
-		it =(char*)iter->location;
-#endif
-		while (it != 0 && len < 1024 - 256) {
-			it += 1;
-			len += 1;
-		}
-
-		u32 allocationHeaderPadding = 0;
-		if (iter->alignment != 0) {  // Add padding to the header to compensate for alignment
-			allocationHeaderPadding = iter->alignment - 1; // Somewhere in this range, we will be aligned
-		}
-
-		u32 paddedSize = iter->size + sizeof(Memory::Allocation) + allocationHeaderPadding;
-		u32 pages = paddedSize / allocator->pageSize + (paddedSize % allocator->pageSize ? 1 : 0);
-		wsprintfW(displaybuffer, L"Size: %d/%d bytes, Pages: %d, >", iter->size, paddedSize, pages);
-		wchar_t* print_to = displaybuffer;
-		while (*print_to != L'>') {
-			print_to++;
-		}
-#if MEM_TRACK_LOCATION
-		if (iter->location != 0) {
-			MultiByteToWideChar(0, 0, iter->location, (int)len, print_to, (int)len);
-		}
-#endif
-
+	for (u32 i = 0; i < gNumAllocations; ++i) {
+		u32 offset = (u32)((u8*)gAllocations[i].memory - (u8*)allocator);
+		u32 page = offset / allocator->pageSize;
+		wsprintfW(displaybuffer, L"Size: %d bytes, Offset: %d, Page: %d", gAllocations[i].bytes, offset, page);
 		SendMessageW(list, LB_ADDSTRING, 0, (LPARAM)displaybuffer);
 	}
 
@@ -469,7 +423,7 @@ void RedrawMemoryChart(HWND hwnd, Win32Color& bgColor, Win32Color& trackMemoryCo
 	const u32 numRows = clientHeight / (pagePadding + pageHeight + pagePadding) + (clientHeight % (pagePadding + pageHeight + pagePadding) ? 1 : 0);
 
 	MemoryDebugInfo memInfo(Memory::GlobalAllocator);
-	u32* mask = (u32*)memInfo.PageMask;
+	Memory::TrackingUnit* mask = (Memory::TrackingUnit*)memInfo.PageMask;
 
 	u32 firstVisibleRow = scrollY / (pagePadding + pageHeight + pagePadding);
 	if (scrollY % (pagePadding + pageHeight + pagePadding) != 0 && firstVisibleRow >= 1) {
@@ -497,7 +451,7 @@ void RedrawMemoryChart(HWND hwnd, Win32Color& bgColor, Win32Color& trackMemoryCo
 			// Get memory, see if it's in use
 			const u32 m = index / Memory::TrackingUnitSize;
 			const u32 b = index % Memory::TrackingUnitSize;
-			const bool used = mask[m] & (1 << b);
+			const bool used = mask[m] & ((Memory::TrackingUnit)1 << b);
 
 			draw.left = col * (pagePadding + pageWidth + pagePadding) + pagePadding;
 			draw.right = draw.left + pageWidth;
@@ -753,7 +707,7 @@ LRESULT CALLBACK MemoryChartProc(HWND hwnd, UINT iMsg, WPARAM wParam, LPARAM lPa
 					// Get memory, see if it's in use
 					const u32 m = index / Memory::TrackingUnitSize;
 					const u32 b = index % Memory::TrackingUnitSize;
-					const bool used = mask[m] & (1 << b);
+					const bool used = mask[m] & ((Memory::TrackingUnit)1 << b);
 
 					draw.left = col * (pagePadding + pageWidth + pagePadding) + pagePadding;
 					draw.right = draw.left + pageWidth;
@@ -900,36 +854,35 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT iMsg, WPARAM wParam, LPARAM lParam) {
 				units = 1024 * 1024;
 			}
 
-			Memory::GlobalAllocator->Allocate(howMany * (u32)units);
+			if (gNumAllocations < MAX_SAMPLE_ALLOCATIONS) {
+				u32 bytes = howMany * (u32)units;
+				void* memory = Memory::GlobalAllocator->Allocate(bytes);
+				if (memory != 0) {
+					gAllocations[gNumAllocations].memory = memory;
+					gAllocations[gNumAllocations].bytes = bytes;
+					gNumAllocations += 1;
+				}
+			}
 
 			update = true;
 		}
 		if (LOWORD(wParam) == ID_FREE_MEM) {
 			int selection = (int)SendMessage(hwndList, LB_GETCURSEL, 0, 0);
 			if (selection >= 0) {
-				int counter = 0;
-				Memory::Allocation* iter = Memory::GlobalAllocator->active;
-				WinAssert(iter != 0);
-				for (; iter != 0 && counter != selection; iter = (iter->nextOffset == 0)? 0 : (Memory::Allocation*)((u8*)Memory::GlobalAllocator + iter->nextOffset), counter++);
-				WinAssert(counter == selection);
-				u8* mem = (u8*)iter + sizeof(Memory::Allocation);
-				Memory::GlobalAllocator->Release(mem);
+				WinAssert((u32)selection < gNumAllocations);
+				Memory::GlobalAllocator->Release(gAllocations[selection].memory);
+				for (u32 i = (u32)selection + 1; i < gNumAllocations; ++i) {
+					gAllocations[i - 1] = gAllocations[i];
+				}
+				gNumAllocations -= 1;
 			}
 			update = true;
 		}
 		if (LOWORD(wParam) == ID_FREE_MEM_ALL) {
-			Memory::Allocation* iter = Memory::GlobalAllocator->active;
-			while (iter != 0) {
-				Memory::Allocation* next = 0;
-				if (iter->nextOffset != 0) {
-					next = (Memory::Allocation*)((u8*)Memory::GlobalAllocator + iter->nextOffset);
-				}
-
-				u8* mem = (u8*)iter + sizeof(Memory::Allocation);
-				Memory::GlobalAllocator->Release(mem);
-
-				iter = next;
+			for (u32 i = 0; i < gNumAllocations; ++i) {
+				Memory::GlobalAllocator->Release(gAllocations[i].memory);
 			}
+			gNumAllocations = 0;
 			update = true;
 		}
 		if (LOWORD(wParam) == ID_REFRESH_MEM) {
@@ -1117,14 +1070,10 @@ extern "C" DWORD CALLBACK run() {
 	Memory::GlobalAllocator->Delete(textColor);
 
 	// Free up any dangling memory (maybe add to debug?)
-	Memory::Allocation* iter = Memory::GlobalAllocator->active;
-	while (iter != 0) {
-		Memory::Allocation* next = (iter->nextOffset == 0) ? 0 :  (Memory::Allocation*)((u8*)Memory::GlobalAllocator + iter->nextOffset);
-		u8* mem = (u8*)iter + sizeof(Memory::Allocation);
-		Memory::GlobalAllocator->Release(mem);
-
-		iter = next;
+	for (u32 i = 0; i < gNumAllocations; ++i) {
+		Memory::GlobalAllocator->Release(gAllocations[i].memory);
 	}
+	gNumAllocations = 0;
 
 	Memory::Shutdown(Memory::GlobalAllocator);
 	Memory::GlobalAllocator = 0;
@@ -3,6 +3,23 @@
 #pragma warning(disable:6011)
 #pragma warning(disable:28182)
 
+#if defined(_MSC_VER) && !defined(__clang__)
+	#include <intrin.h> // _BitScanForward, _BitScanReverse, __cpuid, SSE2 and AVX2
+#endif
+
+#if MEM_USE_SIMD && !MEM_LOCK_FREE_PAGES && (defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+	#define MEM_SIMD_X86 1
+	#if !defined(_MSC_VER) || defined(__clang__)
+		#include <immintrin.h>
+		#include <cpuid.h>
+	#endif
+#else
+	#define MEM_SIMD_X86 0
+#endif
+
+// Both TLSF and best fit track free page runs in the page run index
+#define MEM_PAGE_RUN_LISTS (MEM_TLSF || MEM_BEST_FIT)
+
 #ifndef ATLAS_U16
 	#define ATLAS_U16
 	typedef unsigned short u16;
@@ -48,6 +65,218 @@ namespace Memory {
 #endif
 	}
 
+	// Adds to a counter that is shared by all threads, like requested. To subtract, add 0u - amount. Returns the new value.
+	static inline u32 AtomicAdd(u32* value, u32 amount) {
+#if !MEM_THREAD_SAFE
+		return *value += amount;
+#elif defined(_MSC_VER) && !defined(__clang__)
+		return (u32)_InterlockedExchangeAdd((volatile long*)value, (long)amount) + amount;
+#else
+		return __atomic_add_fetch(value, amount, __ATOMIC_RELAXED);
+#endif
+	}
+
+	// Raises a counter that is shared by all threads to at least candidate, like peekPagesUsed
+	static inline void AtomicMax(u32* value, u32 candidate) {
+#if !MEM_THREAD_SAFE
+		if (*value < candidate) {
+			*value = candidate;
+		}
+#elif defined(_MSC_VER) && !defined(__clang__)
+		long current = *(volatile long*)value;
+		while ((u32)current < candidate) {
+			const long previous = _InterlockedCompareExchange((volatile long*)value, (long)candidate, current);
+			if (previous == current) {
+				break;
+			}
+			current = previous;
+		}
+#else
+		u32 current = __atomic_load_n(value, __ATOMIC_RELAXED);
+		while (current < candidate && !__atomic_compare_exchange_n(value, &current, candidate, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+#endif
+	}
+
+	// Reads and writes a counter that other threads change without holding a lock, like scanBit with MEM_LOCK_FREE_PAGES
+	static inline u32 AtomicLoad(const u32* value) {
+#if !MEM_THREAD_SAFE
+		return *value;
+#elif defined(_MSC_VER) && !defined(__clang__)
+		return *(volatile const u32*)value;
+#else
+		return __atomic_load_n(value, __ATOMIC_RELAXED);
+#endif
+	}
+
+	static inline void AtomicStore(u32* value, u32 newValue) {
+#if !MEM_THREAD_SAFE
+		*value = newValue;
+#elif defined(_MSC_VER) && !defined(__clang__)
+		*(volatile u32*)value = newValue;
+#else
+		__atomic_store_n(value, newValue, __ATOMIC_RELAXED);
+#endif
+	}
+
+	// Spin locks for MEM_THREAD_SAFE, a lock is a u32 that is 1 while it's held. Threads that wait for a lock only
+	// read it until it looks free, so they don't keep taking its cache line away from the thread that holds it.
+	// After LockSpins reads they call MEM_THREAD_YIELD between reads. Without MEM_THREAD_SAFE locking and
+	// unlocking does nothing.
+	const u32 LockSpins = 64;
+
+	static inline void CpuRelax() {
+#if defined(_MSC_VER) && !defined(__clang__) && (defined(_M_X64) || defined(_M_IX86))
+		_mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+		__asm__ __volatile__("yield");
+#endif
+	}
+
+	static inline void Lock(u32* lock) {
+#if MEM_THREAD_SAFE
+	#if defined(_MSC_VER) && !defined(__clang__)
+		while (_InterlockedExchange((volatile long*)lock, 1) != 0) {
+			for (u32 spins = 0; *(volatile u32*)lock != 0; ++spins) {
+				if (spins < LockSpins) {
+					CpuRelax();
+				}
+				else {
+					MEM_THREAD_YIELD();
+				}
+			}
+		}
+	#else
+		while (__atomic_exchange_n(lock, 1u, __ATOMIC_ACQUIRE) != 0) {
+			for (u32 spins = 0; __atomic_load_n(lock, __ATOMIC_RELAXED) != 0; ++spins) {
+				if (spins < LockSpins) {
+					CpuRelax();
+				}
+				else {
+					MEM_THREAD_YIELD();
+				}
+			}
+		}
+	#endif
+#endif
+	}
+
+	static inline void Unlock(u32* lock) {
+#if MEM_THREAD_SAFE
+		assert(AtomicLoad(lock) != 0, "Memory::Unlock, the lock is not held");
+	#if defined(_MSC_VER) && !defined(__clang__)
+		_InterlockedExchange((volatile long*)lock, 0);
+	#else
+		__atomic_store_n(lock, 0u, __ATOMIC_RELEASE);
+	#endif
+#endif
+	}
+
+	// The page mask and the summary mask are read through LoadUnit. With MEM_LOCK_FREE_PAGES other threads change them
+	// while they are being searched, so every read is an atomic load. A search that reads a stale unit either finds
+	// pages that are already taken, which ClaimRange catches, or misses pages that were just released.
+	static inline TrackingUnit LoadUnit(const TrackingUnit* unit) {
+#if !MEM_LOCK_FREE_PAGES
+		return *unit;
+#elif defined(_MSC_VER) && !defined(__clang__)
+		return *(volatile const TrackingUnit*)unit;
+#else
+		return __atomic_load_n(unit, __ATOMIC_RELAXED);
+#endif
+	}
+
+#if MEM_LOCK_FREE_PAGES
+	// Changes to the masks are sequentially consistent, MarkUnitFull relies on that to keep the summary mask right.
+	static inline bool CompareExchangeUnit(TrackingUnit* unit, TrackingUnit* expected, TrackingUnit desired) {
+	#if defined(_MSC_VER) && !defined(__clang__)
+		TrackingUnit previous = 0;
+		if (sizeof(TrackingUnit) == 8) {
+			previous = (TrackingUnit)_InterlockedCompareExchange64((volatile __int64*)unit, (__int64)desired, (__int64)*expected);
+		}
+		else {
+			previous = (TrackingUnit)_InterlockedCompareExchange((volatile long*)unit, (long)desired, (long)*expected);
+		}
+		const bool exchanged = previous == *expected;
+		*expected = previous;
+		return exchanged;
+	#else
+		return __atomic_compare_exchange_n(unit, expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	#endif
+	}
+
+	// Sets or clears bits of a unit, returns the unit from before the change
+	static inline TrackingUnit FetchOrUnit(TrackingUnit* unit, TrackingUnit bits) {
+	#if defined(_MSC_VER) && !defined(__clang__)
+		TrackingUnit expected = *(volatile TrackingUnit*)unit;
+		while (!CompareExchangeUnit(unit, &expected, expected | bits));
+		return expected;
+	#else
+		return __atomic_fetch_or(unit, bits, __ATOMIC_SEQ_CST);
+	#endif
+	}
+
+	static inline TrackingUnit FetchAndUnit(TrackingUnit* unit, TrackingUnit bits) {
+	#if defined(_MSC_VER) && !defined(__clang__)
+		TrackingUnit expected = *(volatile TrackingUnit*)unit;
+		while (!CompareExchangeUnit(unit, &expected, expected & bits));
+		return expected;
+	#else
+		return __atomic_fetch_and(unit, bits, __ATOMIC_SEQ_CST);
+	#endif
+	}
+
+	// Reads a unit in the same total order as the changes, which a relaxed LoadUnit does not
+	static inline TrackingUnit LoadUnitOrdered(TrackingUnit* unit) {
+	#if defined(_MSC_VER) && !defined(__clang__)
+		return FetchOrUnit(unit, 0); // Or-ing nothing is a read in the same order
+	#else
+		return __atomic_load_n(unit, __ATOMIC_SEQ_CST);
+	#endif
+	}
+
+	// Sets the summary bit of a unit that just had pages released. The bit is usually set already, so it's read
+	// first. If a thread clears it after that read, MarkUnitFull on that thread sees the released pages.
+	static inline void MarkUnitFree(TrackingUnit* summary, u32 m) {
+		const TrackingUnit bit = (TrackingUnit)1 << (m % TrackingUnitSize);
+		if ((LoadUnitOrdered(&summary[m / TrackingUnitSize]) & bit) == 0) {
+			FetchOrUnit(&summary[m / TrackingUnitSize], bit);
+		}
+	}
+
+	// Called after pages are cleared in the masks, either released or given back by a claim that failed. A search
+	// that read pagesReturned before it started, and reads the same number after it failed, didn't miss any pages
+	// that were given back while it ran. Both are ordered after the changes to the masks.
+	static inline void CountPagesReturned(Allocator* allocator) {
+	#if defined(_MSC_VER) && !defined(__clang__)
+		_InterlockedIncrement((volatile long*)&allocator->pagesReturned);
+	#else
+		__atomic_add_fetch(&allocator->pagesReturned, 1u, __ATOMIC_SEQ_CST);
+	#endif
+	}
+
+	static inline u32 LoadPagesReturned(Allocator* allocator) {
+	#if defined(_MSC_VER) && !defined(__clang__)
+		return (u32)_InterlockedOr((volatile long*)&allocator->pagesReturned, 0);
+	#else
+		return __atomic_load_n(&allocator->pagesReturned, __ATOMIC_SEQ_CST);
+	#endif
+	}
+#endif
+
+	// The page lock is only taken if pages are not claimed with atomics
+	static inline void LockPages(Allocator* allocator) {
+#if !MEM_LOCK_FREE_PAGES
+		Lock(&allocator->pageLock);
+#endif
+	}
+
+	static inline void UnlockPages(Allocator* allocator) {
+#if !MEM_LOCK_FREE_PAGES
+		Unlock(&allocator->pageLock);
+#endif
+	}
+
 	static inline u32 AllocatorPaddedSize() {
 		static_assert (sizeof(Memory::Allocator) % AllocatorAlignment == 0, "Memory::Allocator size needs to be 8 byte aligned for the allocation mask to start on this alignment without any padding");
 		return sizeof(Allocator);
@@ -69,6 +298,224 @@ namespace Memory {
 		return allocatorPageArraySize * (TrackingUnitSize / 8); // In bytes, not bits
 	}
 
+	// The summary mask follows the page mask. It has one bit for each tracking unit of the page mask, and that bit 
+	// is set if the tracking unit has at least one free page. The page search uses it to jump over used memory.
+	static inline u8* AllocatorSummaryMask(Allocator* allocator) {
+		return AllocatorPageMask(allocator) + AllocatorPageMaskSize(allocator);
+	}
+
+	static inline u32 AllocatorSummaryMaskSize(Allocator* allocator) { // This is the number of u8's that make up the AllocatorSummaryMask array
+		const u32 numTrackingUnits = AllocatorPageMaskSize(allocator) / sizeof(TrackingUnit);
+		const u32 summaryArraySize = numTrackingUnits / TrackingUnitSize + (numTrackingUnits % TrackingUnitSize ? 1 : 0);
+		return summaryArraySize * (TrackingUnitSize / 8); // In bytes, not bits
+	}
+
+#if MEM_PAGE_RUN_LISTS
+	// Two-Level Segregated Fit. Free page runs are kept in lists that are bucketed by the size of the run. The first
+	// level splits run sizes by powers of two, the second level splits each power of two into PageRunSecondLevels
+	// linear steps. A bit is set in firstLevel for every first level that has a non empty list, and a bit is set in
+	// secondLevel for every non empty list. Finding a list that can hold a run takes two count trailing zeros.
+	// Best fit uses the same lists, it only differs in which run it picks.
+	const u32 PageRunSecondLevelBits = 4;
+	const u32 PageRunSecondLevels = 1 << PageRunSecondLevelBits;
+	const u32 PageRunFirstLevels = 32;
+	const u32 PageRunFallbackRuns = 8; // How many runs TLSF checks in the list a request maps to, before it gives up
+
+	struct PageRunIndex {
+		u32 firstLevel;
+		u32 padding;
+		u32 secondLevel[PageRunFirstLevels];
+		u32 heads[PageRunFirstLevels][PageRunSecondLevels]; // First page of the first run in each list, 0 if empty
+	};
+
+	// Every free run stores one of these at the end of its first page. Keeping the run info at the end of the page
+	// means Release can still write to an allocation header at the start of the page after the page has been
+	// released. The page descriptors are used to find the free runs on either side of a run.
+	struct FreePageRun {
+		u32 firstPage;
+		u32 numPages;
+		u32 prevRun; // First page of the previous run in the same list, 0 if this is the head
+		u32 nextRun; // First page of the next run in the same list, 0 if this is the tail
+	};
+#elif MEM_BUDDY
+	// Buddy blocks. A free block of order n is 2^n pages long and starts on a page index that is a multiple of 2^n.
+	// Its buddy is the block of the same order that it was split from, found by flipping bit n of its first page.
+	// There is one free list per order, and a bit is set in nonEmpty for every order that has a free block.
+	const u32 BuddyMaxOrders = 32;
+
+	struct BuddyIndex {
+		u32 nonEmpty;
+		u32 padding;
+		u32 heads[BuddyMaxOrders]; // First page of the first free block of each order, 0 if empty
+		// Followed by one u8 per page. The first page of a free block holds the order of the block + 1, every
+		// other page holds 0. The pages used by the meta data are never free, so blocks never merge into them.
+	};
+
+	// Stored at the end of the first page of every free block, for the same reason as FreePageRun
+	struct BuddyBlock {
+		u32 prevBlock; // 0 if this is the head of the list
+		u32 nextBlock; // 0 if this is the tail of the list
+	};
+#endif
+
+	// The page run index follows the summary mask. It only exists if page runs are tracked in free lists.
+	static inline u8* AllocatorPageRunIndex(Allocator* allocator) {
+		return AllocatorSummaryMask(allocator) + AllocatorSummaryMaskSize(allocator);
+	}
+
+	static inline u32 AllocatorPageRunIndexSize(Allocator* allocator) { // In bytes
+#if MEM_PAGE_RUN_LISTS
+		return sizeof(PageRunIndex);
+#elif MEM_BUDDY
+		const u32 numPages = allocator->size / allocator->pageSize;
+		return sizeof(BuddyIndex) + numPages + (numPages % AllocatorAlignment ? AllocatorAlignment - numPages % AllocatorAlignment : 0);
+#else
+		return 0;
+#endif
+	}
+
+	// Every page has a descriptor that says what the page is used for, and which run of pages it belongs to. Only the
+	// first and last page of a run are kept up to date. For large allocations, so is the page that the returned
+	// memory starts in, which is not the first page if the allocation is aligned to more than a page. Free runs
+	// are only merged with their neighbours in TLSF, best fit and buddy mode, otherwise the descriptors of a free 
+	// run describe the pages that were released together.
+	const u8 PageKindFree = 0;
+	const u8 PageKindLarge = 1;	// Pages of a single allocation
+	const u8 PageKindSlab = 2;	// A page that a sub-allocator carved into blocks, sizeClass says which one
+	const u8 PageKindMeta = 3;	// The allocator header, masks, indices, descriptors and the debug page
+
+	struct PageDescriptor {
+		u32 runStart;
+		u32 runLength;
+		u8 kind;
+		u8 sizeClass;
+		u16 liveBlocks;		// Slab pages only, the number of blocks that are allocated
+		union {
+			u32 freeBlocks;	// Slab pages only, offset of the first released block from the allocator, 0 if there is none
+			u32 header;		// Large pages only, offset of the allocation header from the allocator
+		};
+		union {
+			u32 prevSlab;	// Slab pages only, the previous and next slab of the same size class that have free blocks
+			u32 locationLow;	// Large pages only, with MEM_COMPACT_HEADER the location of the allocation is split in two
+		};
+		union {
+			u32 nextSlab;
+			u32 locationHigh;
+		};
+		u16 carvedBlocks;	// Slab pages only, blocks past this one have never been handed out
+		u16 arena;			// Slab and large pages only, the index of the arena that the run was allocated from
+	};
+
+	// The page descriptors follow the page run index
+	static inline PageDescriptor* AllocatorPageDescriptors(Allocator* allocator) {
+		return (PageDescriptor*)(AllocatorPageRunIndex(allocator) + AllocatorPageRunIndexSize(allocator));
+	}
+
+	static inline u32 AllocatorPageDescriptorsSize(Allocator* allocator) { // In bytes
+		const u32 size = (allocator->size / allocator->pageSize) * sizeof(PageDescriptor);
+		return size + (size % AllocatorAlignment ? AllocatorAlignment - size % AllocatorAlignment : 0);
+	}
+
+	// Writes the descriptor of the first and last page of a run
+	static inline void SetPageDescriptors(Allocator* allocator, u32 runStart, u32 runLength, u8 kind, u8 sizeClass) {
+		PageDescriptor* descriptors = AllocatorPageDescriptors(allocator);
+		PageDescriptor* first = &descriptors[runStart];
+		first->runStart = runStart;
+		first->runLength = runLength;
+		first->kind = kind;
+		first->sizeClass = sizeClass;
+		first->arena = 0;
+		descriptors[runStart + runLength - 1] = *first;
+	}
+
+	// The arenas follow the page descriptors. The first arena starts on a cache line boundary, if the allocator
+	// does, and every arena is padded out to a whole number of cache lines.
+	const u32 CacheLineSize = 64;
+	const u32 ArenaSize = (sizeof(Arena) + CacheLineSize - 1) / CacheLineSize * CacheLineSize;
+
+	static inline u8* AllocatorArenas(Allocator* allocator) {
+		const u8* descriptorsEnd = (u8*)AllocatorPageDescriptors(allocator) + AllocatorPageDescriptorsSize(allocator);
+		const u32 offset = (u32)(descriptorsEnd - (u8*)allocator);
+		return (u8*)allocator + (offset + CacheLineSize - 1) / CacheLineSize * CacheLineSize;
+	}
+
+	static inline u32 AllocatorArenasSize(Allocator* allocator) { // In bytes, including the padding before the first arena
+		const u8* descriptorsEnd = (u8*)AllocatorPageDescriptors(allocator) + AllocatorPageDescriptorsSize(allocator);
+		return (u32)(AllocatorArenas(allocator) - descriptorsEnd) + allocator->numArenas * ArenaSize;
+	}
+
+	static inline Arena* ArenaAt(Allocator* allocator, u32 index) {
+		assert(index < allocator->numArenas, "Memory::ArenaAt, arena index out of range");
+		return (Arena*)((u8*)allocator->arenas + index * ArenaSize);
+	}
+
+	// The arena that a run of slab or large pages was allocated from. Every page of the run knows it.
+	static inline Arena* ArenaOfPage(Allocator* allocator, u32 page) {
+		return ArenaAt(allocator, AllocatorPageDescriptors(allocator)[page].arena);
+	}
+
+	// The arena that the calling thread is bound to, plus one. It's 0 until the thread allocates, or calls BindThread.
+#if MEM_THREAD_SAFE
+	static thread_local u32 threadArena;
+#else
+	static u32 threadArena;
+#endif
+
+	// Returns the arena of the calling thread. A thread that isn't bound yet is bound to the next arena, round robin.
+	static inline Arena* ThreadArena(Allocator* allocator) {
+		if (allocator->numArenas == 1) {
+			return allocator->arenas;
+		}
+		u32 arena = threadArena;
+		if (arena == 0) {
+			arena = AtomicAdd(&allocator->nextArena, 1); // The new value, which is the arena plus one
+			threadArena = arena;
+		}
+		return ArenaAt(allocator, (arena - 1) % allocator->numArenas);
+	}
+
+#if MEM_TRACK_LOCATION
+	// Where an allocation that has a header was made. With MEM_COMPACT_HEADER the location doesn't fit in the
+	// header, it's kept in the descriptor of the first page of the allocation.
+	static inline void SetAllocationLocation(Allocator* allocator, Allocation* allocation, u32 firstPage, const char* location) {
+	#if MEM_COMPACT_HEADER
+		PageDescriptor* descriptor = &AllocatorPageDescriptors(allocator)[firstPage];
+		const u64 address = (u64)(ptr_type)location;
+		descriptor->locationLow = (u32)address;
+		descriptor->locationHigh = (u32)(address >> 32);
+	#else
+		allocation->location = location;
+	#endif
+	}
+
+	static inline const char* AllocationLocation(Allocator* allocator, const Allocation* allocation) {
+	#if MEM_COMPACT_HEADER
+		const u32 memoryPage = (u32)((const u8*)(allocation + 1) - (u8*)allocator) / allocator->pageSize;
+		const PageDescriptor* descriptors = AllocatorPageDescriptors(allocator);
+		const PageDescriptor* descriptor = &descriptors[descriptors[memoryPage].runStart];
+		return (const char*)(ptr_type)((u64)descriptor->locationLow | ((u64)descriptor->locationHigh << 32));
+	#else
+		return allocation->location;
+	#endif
+	}
+#endif
+
+	// How many pages the allocator header, the page mask, the summary mask, the page run index, the page descriptors,
+	// the arenas and the debug page take up. The meta data is padded out to a page boundary, and the debug page
+	// follows it. The first allocatable page comes after the debug page.
+	static inline u32 AllocatorOverheadPages(Allocator* allocator) {
+		u32 metaDataSizeBytes = AllocatorPaddedSize() + AllocatorPageMaskSize(allocator) + AllocatorSummaryMaskSize(allocator) + AllocatorPageRunIndexSize(allocator) + AllocatorPageDescriptorsSize(allocator) + AllocatorArenasSize(allocator);
+		u32 numberOfMasksUsed = metaDataSizeBytes / allocator->pageSize;
+		if (metaDataSizeBytes % allocator->pageSize != 0) {
+			numberOfMasksUsed += 1;
+		}
+
+		// Account for the debug page
+		numberOfMasksUsed += 1;
+		return numberOfMasksUsed;
+	}
+
+#if MEM_TRACK_ACTIVE
 	static inline void RemoveFromList(Allocator* allocator, Allocation** list, Allocation* allocation) {
 		u32 allocationOffset = (u32)((u8*)allocation - (u8*)allocator);
 		u32 listOffset = (u32)((u8*)(*list) - (u8*)allocator);
@@ -125,117 +572,372 @@ namespace Memory {
 		}
 		*list = allocation;
 	}
+#else
+	// Without the active list, allocations that have a header are found from the descriptor of their first page.
+	// A used page that follows a free page, or the end of a used run, starts a run. Its descriptor is up to date.
+	// Returns the header of the first large allocation that starts at or after page, 0 if there is none.
+	static inline Allocation* FindLargeAllocation(Allocator* allocator, u32 page) {
+		const u32 numPages = allocator->size / allocator->pageSize;
+		const TrackingUnit* mask = (TrackingUnit*)AllocatorPageMask(allocator);
+		const PageDescriptor* descriptors = AllocatorPageDescriptors(allocator);
+		while (page < numPages) {
+			if ((mask[page / TrackingUnitSize] & ((TrackingUnit)1 << (page % TrackingUnitSize))) == 0) {
+				page += 1;
+				continue;
+			}
 
-	// Returns 0 on error. Since the first page is always tracking overhead it's invalid for a range
-	static inline u32 FindRange(Allocator* allocator, u32 numPages, u32 searchStartBit) {
-		assert(allocator != 0, __LOCATION__);
-		assert(numPages != 0, __LOCATION__);
+			const PageDescriptor* descriptor = &descriptors[page];
+			assert(descriptor->runStart == page && descriptor->runLength > 0, "Memory::FindLargeAllocation, corrupt page descriptor");
+			if (descriptor->kind == PageKindLarge) {
+				return (Allocation*)((u8*)allocator + descriptor->header);
+			}
+			page += descriptor->runLength;
+		}
+		return 0;
+	}
 
-		u32 * mask = (u32*)AllocatorPageMask(allocator);
-		u32 numBitsInMask = AllocatorPageMaskSize(allocator) * 8;
-		u32 numElementsInMask = AllocatorPageMaskSize(allocator) / (TrackingUnitSize / 8);
-		assert(allocator->size % allocator->pageSize == 0, "Memory::FindRange, the allocators size must be a multiple of Memory::PageSize, otherwise there would be a partial page at the end");
-		assert(mask != 0, __LOCATION__);
-		assert(numBitsInMask != 0, __LOCATION__);
+	static inline Allocation* NextLargeAllocation(Allocator* allocator, Allocation* allocation) {
+		const u32 memoryPage = (u32)((u8*)(allocation + 1) - (u8*)allocator) / allocator->pageSize;
+		const PageDescriptor* descriptor = &AllocatorPageDescriptors(allocator)[memoryPage];
+		return FindLargeAllocation(allocator, descriptor->runStart + descriptor->runLength);
+	}
+#endif
 
-		u32 startBit = 0;
-		u32 numBits = 0;
+	// Returns the index of the lowest set bit. The value being scanned must not be 0.
+	static inline u32 CountTrailingZeros(TrackingUnit value) {
+		assert(value != 0, __LOCATION__);
+#if defined(_MSC_VER) && !defined(__clang__)
+		unsigned long index = 0;
+	#if MEM_TRACKING_UNIT_64
+		if ((u32)value == 0) {
+			_BitScanForward(&index, (u32)(value >> 32));
+			return (u32)index + 32;
+		}
+	#endif
+		_BitScanForward(&index, (u32)value);
+		return (u32)index;
+#else
+	#if MEM_TRACKING_UNIT_64
+		return (u32)__builtin_ctzll(value);
+	#else
+		return (u32)__builtin_ctz(value);
+	#endif
+#endif
+	}
 
-		for (u32 i = searchStartBit; i < numBitsInMask; ++i) {
-			u32 m = i / TrackingUnitSize;
-			u32 b = i % TrackingUnitSize;
+	// Returns the number of zero bits above the highest set bit. The value being scanned must not be 0.
+	static inline u32 CountLeadingZeros(TrackingUnit value) {
+		assert(value != 0, __LOCATION__);
+#if defined(_MSC_VER) && !defined(__clang__)
+		unsigned long index = 0;
+	#if MEM_TRACKING_UNIT_64
+		if ((u32)(value >> 32) != 0) {
+			_BitScanReverse(&index, (u32)(value >> 32));
+			return 31 - (u32)index;
+		}
+		_BitScanReverse(&index, (u32)value);
+		return 63 - (u32)index;
+	#else
+		_BitScanReverse(&index, (u32)value);
+		return 31 - (u32)index;
+	#endif
+#else
+	#if MEM_TRACKING_UNIT_64
+		return (u32)__builtin_clzll(value);
+	#else
+		return (u32)__builtin_clz(value);
+	#endif
+#endif
+	}
 
-			assert(m < numElementsInMask, "indexing mask out of range");
-			bool set = mask[m] & (1 << b);
+	// Returns the first tracking unit in the [firstUnit, lastUnit) range that is not equal to value, or lastUnit if
+	// they all are. FindRange uses this to skip over long stretches of fully used or fully free memory.
+	typedef u32 (*SkipUnitsFunc)(const TrackingUnit* mask, u32 firstUnit, u32 lastUnit, TrackingUnit value);
 
-			if (!set) {
-				if (startBit == 0) {
-					startBit = i;
-					numBits = 1;
-				}
-				else {
-					numBits++;
-				}
-			}
-			else {
-				startBit = 0;
-				numBits = 0;
+	static u32 SkipUnitsScalar(const TrackingUnit* mask, u32 firstUnit, u32 lastUnit, TrackingUnit value) {
+		u32 m = firstUnit;
+		while (m < lastUnit && LoadUnit(&mask[m]) == value) {
+			++m;
+		}
+		return m;
+	}
+
+#if MEM_SIMD_X86
+	// Compares 128 bits of the mask per step. Value is either all 0's or all 1's, so comparing
+	// 32 bit lanes works for both 32 and 64 bit tracking units. The mask is only 8 byte aligned.
+	static u32 SkipUnitsSSE2(const TrackingUnit* mask, u32 firstUnit, u32 lastUnit, TrackingUnit value) {
+		const u32 unitsPerStep = 16 / sizeof(TrackingUnit);
+		const __m128i pattern = _mm_set1_epi32((int)(u32)value);
+
+		u32 m = firstUnit;
+		while (m + unitsPerStep <= lastUnit) {
+			__m128i units = _mm_loadu_si128((const __m128i*)(mask + m));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi32(units, pattern)) != 0xFFFF) {
+				break;
 			}
+			m += unitsPerStep;
+		}
+
+		return SkipUnitsScalar(mask, m, lastUnit, value);
+	}
 
-			if (numBits == numPages) {
+	// Same as SkipUnitsSSE2, but compares 256 bits per step. Only called if the CPU supports AVX2
+	#if !defined(_MSC_VER) || defined(__clang__)
+	__attribute__((target("avx2")))
+	#endif
+	static u32 SkipUnitsAVX2(const TrackingUnit* mask, u32 firstUnit, u32 lastUnit, TrackingUnit value) {
+		const u32 unitsPerStep = 32 / sizeof(TrackingUnit);
+		const __m256i pattern = _mm256_set1_epi32((int)(u32)value);
+
+		u32 m = firstUnit;
+		while (m + unitsPerStep <= lastUnit) {
+			__m256i units = _mm256_loadu_si256((const __m256i*)(mask + m));
+			if ((u32)_mm256_movemask_epi8(_mm256_cmpeq_epi32(units, pattern)) != 0xFFFFFFFF) {
 				break;
 			}
+			m += unitsPerStep;
 		}
 
-		if (numBits != numPages || startBit == 0) {
-			startBit = 0;
-			numBits = 0;
+		return SkipUnitsScalar(mask, m, lastUnit, value);
+	}
 
-			for (u32 i = 0; i < searchStartBit; ++i) {
-				u32 m = i / TrackingUnitSize;
-				u32 b = i % TrackingUnitSize;
+	static bool CpuSupportsAVX2() {
+		u32 info[4] = { 0 }; // eax, ebx, ecx, edx
+#if defined(_MSC_VER) && !defined(__clang__)
+		__cpuid((int*)info, 0);
+		if (info[0] < 7) {
+			return false;
+		}
+		__cpuid((int*)info, 1);
+#else
+		if (__get_cpuid_max(0, 0) < 7) {
+			return false;
+		}
+		__cpuid(1, info[0], info[1], info[2], info[3]);
+#endif
+		const bool osxsave = (info[2] & (1 << 27)) != 0;
+		const bool avx = (info[2] & (1 << 28)) != 0;
+		if (!osxsave || !avx) {
+			return false;
+		}
 
-				bool set = mask[m] & (1 << b);
+		// Make sure the OS saves the upper half of the ymm registers
+#if defined(_MSC_VER) && !defined(__clang__)
+		u64 xcr0 = _xgetbv(0);
+#else
+		u32 xcr0Low = 0, xcr0High = 0;
+		__asm__ volatile ("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+		u64 xcr0 = ((u64)xcr0High << 32) | xcr0Low;
+#endif
+		if ((xcr0 & 6) != 6) {
+			return false;
+		}
 
-				if (!set) {
-					if (startBit == 0) {
-						startBit = i;
-						numBits = 1;
-					}
-					else {
-						numBits++;
-					}
+#if defined(_MSC_VER) && !defined(__clang__)
+		__cpuidex((int*)info, 7, 0);
+#else
+		__cpuid_count(7, 0, info[0], info[1], info[2], info[3]);
+#endif
+		return (info[1] & (1 << 5)) != 0;
+	}
+
+	static SkipUnitsFunc SkipUnits = SkipUnitsSSE2;
+#else
+	static SkipUnitsFunc SkipUnits = SkipUnitsScalar;
+#endif
+
+	// Picks the widest SkipUnits kernel that the CPU supports. Called by Initialize.
+	static inline void SelectSkipUnitsKernel() {
+#if MEM_SIMD_X86
+		SkipUnits = CpuSupportsAVX2() ? SkipUnitsAVX2 : SkipUnitsSSE2;
+#endif
+	}
+
+	// Returns the first tracking unit in the [firstUnit, lastUnit) range that has at least one free page, or lastUnit
+	// if there is none. Only the summary mask is read, each of its units covers TrackingUnitSize units of the page mask.
+	// Summary units with no free pages at all are skipped with the SkipUnits kernel.
+	static inline u32 NextUnitWithFreePages(const TrackingUnit* summary, u32 firstUnit, u32 lastUnit) {
+		if (firstUnit >= lastUnit) {
+			return lastUnit;
+		}
+
+		const TrackingUnit allSet = ~((TrackingUnit)0);
+		const u32 lastSummaryUnit = (lastUnit - 1) / TrackingUnitSize + 1;
+
+		u32 s = firstUnit / TrackingUnitSize;
+		TrackingUnit bits = LoadUnit(&summary[s]) & (allSet << (firstUnit % TrackingUnitSize));
+		while (bits == 0) {
+			s = SkipUnits(summary, s + 1, lastSummaryUnit, 0);
+			if (s == lastSummaryUnit) {
+				return lastUnit;
+			}
+			// With MEM_LOCK_FREE_PAGES another thread can clear the summary unit between the skip and this load
+			bits = LoadUnit(&summary[s]);
+		}
+
+		const u32 unit = s * TrackingUnitSize + CountTrailingZeros(bits);
+		return (unit < lastUnit) ? unit : lastUnit;
+	}
+
+	// Searches the pages in the [firstPage, lastPage) range for numPages contiguous free pages. The mask is read one
+	// tracking unit at a time. A free run that spans units is tracked with the trailing zeros of the unit it enters
+	// and the leading zeros of the unit it leaves. Stretches of fully free units are skipped with the SkipUnits kernel,
+	// fully used units are jumped over using the summary mask. Runs that fit inside a single unit are found by and-ing
+	// the free bits with shifted copies of themselves. Returns the first page of the run, or 0 if there is no such run.
+	static inline u32 FindRangeInRegion(const TrackingUnit* mask, const TrackingUnit* summary, u32 firstPage, u32 lastPage, u32 numPages) {
+		if (firstPage >= lastPage) {
+			return 0;
+		}
+
+		const TrackingUnit allSet = ~((TrackingUnit)0);
+		const u32 firstUnit = firstPage / TrackingUnitSize;
+		const u32 lastUnit = (lastPage - 1) / TrackingUnitSize;
+
+		u32 runStart = 0;
+		u32 runLength = 0;
+
+		for (u32 m = firstUnit; m <= lastUnit; ++m) {
+			TrackingUnit unit = LoadUnit(&mask[m]);
+			if (m == firstUnit && firstPage % TrackingUnitSize != 0) { // Treat pages before the region as used
+				unit |= ~(allSet << (firstPage % TrackingUnitSize));
+			}
+			if (m == lastUnit && lastPage % TrackingUnitSize != 0) { // Treat pages after the region as used
+				unit |= allSet << (lastPage % TrackingUnitSize);
+			}
+
+			if (unit == 0) { // Every page in this unit is free, and so might be the next few
+				if (runLength == 0) {
+					runStart = m * TrackingUnitSize;
 				}
-				else {
-					startBit = 0;
-					numBits = 0;
+				runLength += TrackingUnitSize;
+				if (runLength < numPages && m + 1 < lastUnit) {
+					const u32 nextUnit = SkipUnits(mask, m + 1, lastUnit, 0);
+					runLength += (nextUnit - (m + 1)) * TrackingUnitSize;
+					m = nextUnit - 1;
+				}
+				if (runLength >= numPages) {
+					return runStart;
+				}
+				continue;
+			}
+			else if (unit == allSet) { // Every page in this unit is used, jump to the next unit with free pages
+				runLength = 0;
+				if (m + 1 < lastUnit) {
+					m = NextUnitWithFreePages(summary, m + 1, lastUnit) - 1;
 				}
+				continue;
+			}
 
-				if (numBits == numPages) {
-					break;
+			// The run coming in from the previous unit continues into the low free bits of this one
+			if (runLength == 0) {
+				runStart = m * TrackingUnitSize;
+			}
+			if (runLength + CountTrailingZeros(unit) >= numPages) {
+				return runStart;
+			}
+
+			// Look for a run between two used pages of this unit, those are at most TrackingUnitSize - 2 
+			// pages long. Bit i of runs is set only if pages i through i + numPages - 1 are all free.
+			if (numPages < TrackingUnitSize - 1) {
+				TrackingUnit runs = ~unit;
+				u32 covered = 1;
+				while (covered < numPages && runs != 0) {
+					u32 shift = (covered < numPages - covered) ? covered : numPages - covered;
+					runs &= runs >> shift;
+					covered += shift;
 				}
+				if (runs != 0) {
+					return m * TrackingUnitSize + CountTrailingZeros(runs);
+				}
+			}
+
+			// The high free bits of this unit might start a run that continues into the next one
+			runLength = CountLeadingZeros(unit);
+			runStart = (m + 1) * TrackingUnitSize - runLength;
+			if (runLength >= numPages) {
+				return runStart;
 			}
 		}
 
-		allocator->scanBit = startBit + numPages;
+		return 0;
+	}
+
+	// Returns 0 if there is no free range. Since the first page is always tracking overhead it's invalid for a range.
+	// A miss isn't asserted here, with MEM_LOCK_FREE_PAGES the caller might search again. AllocatePages asserts once
+	// it gives up.
+	static inline u32 FindRange(Allocator* allocator, u32 numPages, u32 searchStartBit) {
+		assert(allocator != 0, __LOCATION__);
+		assert(numPages != 0, __LOCATION__);
+
+		const TrackingUnit* mask = (TrackingUnit*)AllocatorPageMask(allocator);
+		const TrackingUnit* summary = (TrackingUnit*)AllocatorSummaryMask(allocator);
+		const u32 numPagesInMask = allocator->size / allocator->pageSize; // The mask is padded, don't hand out the padding bits
+		assert(allocator->size % allocator->pageSize == 0, "Memory::FindRange, the allocators size must be a multiple of Memory::PageSize, otherwise there would be a partial page at the end");
+		assert(mask != 0, __LOCATION__);
+		assert(numPagesInMask != 0, __LOCATION__);
+
+		u32 startBit = FindRangeInRegion(mask, summary, searchStartBit, numPagesInMask, numPages);
 
-		assert(numBits == numPages, "Memory::FindRange Could not find enough memory to fufill request");
-		assert(startBit != 0, "Memory::FindRange Could not memory fufill request");
-		if (numBits != numPages || startBit == 0 || allocator->size % allocator->pageSize != 0) {
-			assert(false, __LOCATION__);
+		if (startBit == 0 && searchStartBit != 0) {
+			// Wrap around. Runs that straddle searchStartBit are only visible to this second pass, 
+			// so it has to scan up to numPages - 1 bits past where the first pass started.
+			u32 wrapEnd = searchStartBit + numPages - 1;
+			if (wrapEnd > numPagesInMask) {
+				wrapEnd = numPagesInMask;
+			}
+			startBit = FindRangeInRegion(mask, summary, 0, wrapEnd, numPages);
+		}
+
+		if (startBit == 0 || allocator->size % allocator->pageSize != 0) {
 			return 0;
 		}
 
 		return startBit;
 	}
 
+	// Returns a tracking unit with bitCount bits set, starting at firstBit. The range must fit in one tracking unit.
+	static inline TrackingUnit UnitRangeMask(u32 firstBit, u32 bitCount) {
+		const TrackingUnit allSet = ~((TrackingUnit)0);
+		if (bitCount == TrackingUnitSize) {
+			return allSet;
+		}
+		return (((TrackingUnit)1 << bitCount) - 1) << firstBit;
+	}
+
+	// SetRange and ClearRange work one tracking unit at a time. Only the first and last tracking unit of the range
+	// can be partially covered, every unit in between is written as a whole.
 	static inline void SetRange(Allocator* allocator, u32 startBit, u32 bitCount) {
 		assert(allocator != 0, __LOCATION__);
 		assert(bitCount != 0, __LOCATION__);
 
-		u32* mask = (u32*)AllocatorPageMask(allocator);
+		TrackingUnit* mask = (TrackingUnit*)AllocatorPageMask(allocator);
+		TrackingUnit* summary = (TrackingUnit*)AllocatorSummaryMask(allocator);
 		assert(allocator->size % allocator->pageSize == 0, "Memory::FindRange, the allocators size must be a multiple of Memory::PageSize, otherwise there would be a partial page at the end");
 		assert(mask != 0, __LOCATION__);
 
 #if _DEBUG
 		u32 numBitsInMask = AllocatorPageMaskSize(allocator) * 8;
 		assert(numBitsInMask != 0, __LOCATION__);
+		assert(startBit + bitCount <= numBitsInMask, __LOCATION__);
 #endif
 		u32 numElementsInMask = AllocatorPageMaskSize(allocator) / (TrackingUnitSize / 8);
+		const TrackingUnit allSet = ~((TrackingUnit)0);
 
-		for (u32 i = startBit; i < startBit + bitCount; ++i) {
-
-			u32 m = i / TrackingUnitSize;
-			u32 b = i % TrackingUnitSize;
+		const u32 endBit = startBit + bitCount;
+		for (u32 i = startBit; i < endBit;) {
+			const u32 m = i / TrackingUnitSize;
+			const u32 b = i % TrackingUnitSize;
+			const u32 count = (endBit - i < TrackingUnitSize - b) ? endBit - i : TrackingUnitSize - b;
+			const TrackingUnit bits = UnitRangeMask(b, count);
 
 			assert(m < numElementsInMask, "indexing mask out of range");
-#if _DEBUG
-			assert(i < numBitsInMask, __LOCATION__);
-			bool set = mask[m] & (1 << b);
-			assert(!set, __LOCATION__);
-#endif
+			assert((mask[m] & bits) == 0, "Memory::SetRange, setting pages that are already in use");
 
-			mask[m] |= (1 << b);
+			mask[m] |= bits;
+			if (mask[m] == allSet) { // This tracking unit no longer has free pages
+				summary[m / TrackingUnitSize] &= ~((TrackingUnit)1 << (m % TrackingUnitSize));
+			}
+			i += count;
 		}
 
 		assert(allocator->numPagesUsed <= numBitsInMask, "Memory::FindRange, over allocating");
@@ -244,192 +946,1046 @@ namespace Memory {
 		if (allocator->numPagesUsed > allocator->peekPagesUsed) {
 			allocator->peekPagesUsed = allocator->numPagesUsed;
 		}
+
+		// Using pages can only make the largest free run shorter, so the bound stays valid
+		assert(allocator->numPagesFree >= bitCount, "underflow");
+		allocator->numPagesFree -= bitCount;
+		if (allocator->largestFreeRun > allocator->numPagesFree) {
+			allocator->largestFreeRun = allocator->numPagesFree;
+		}
 	}
 
 	static inline void ClearRange(Allocator* allocator, u32 startBit, u32 bitCount) {
 		assert(allocator != 0, __LOCATION__);
 		assert(bitCount != 0, __LOCATION__);
 
-		u32* mask = (u32*)AllocatorPageMask(allocator);
+		TrackingUnit* mask = (TrackingUnit*)AllocatorPageMask(allocator);
+		TrackingUnit* summary = (TrackingUnit*)AllocatorSummaryMask(allocator);
 		assert(allocator->size % allocator->pageSize == 0, "Memory::FindRange, the allocators size must be a multiple of Memory::PageSize, otherwise there would be a partial page at the end");
 		assert(mask != 0, __LOCATION__);
 
 #if _DEBUG
 		u32 numBitsInMask = AllocatorPageMaskSize(allocator) * 8;
 		assert(numBitsInMask != 0, __LOCATION__);
+		assert(startBit + bitCount <= numBitsInMask, __LOCATION__);
 #endif
-
 		u32 numElementsInMask = AllocatorPageMaskSize(allocator) / (TrackingUnitSize / 8);
 
-		for (u32 i = startBit; i < startBit + bitCount; ++i) {
-
-			u32 m = i / TrackingUnitSize;
-			u32 b = i % TrackingUnitSize;
+		const u32 endBit = startBit + bitCount;
+		for (u32 i = startBit; i < endBit;) {
+			const u32 m = i / TrackingUnitSize;
+			const u32 b = i % TrackingUnitSize;
+			const u32 count = (endBit - i < TrackingUnitSize - b) ? endBit - i : TrackingUnitSize - b;
+			const TrackingUnit bits = UnitRangeMask(b, count);
 
 			assert(m < numElementsInMask, "indexing mask out of range");
+#if MEM_LOCK_FREE_PAGES
+			const TrackingUnit previous = FetchAndUnit(&mask[m], ~bits);
+			assert((previous & bits) == bits, "Memory::ClearRange, releasing pages that are not in use");
+			MarkUnitFree(summary, m);
+#else
+			assert((mask[m] & bits) == bits, "Memory::ClearRange, releasing pages that are not in use");
 
-#if _DEBUG
-			assert(i < numBitsInMask, __LOCATION__);
-			bool set = mask[m] & (1 << b);
-			assert(set, __LOCATION__);
+			mask[m] &= ~bits;
+			summary[m / TrackingUnitSize] |= ((TrackingUnit)1 << (m % TrackingUnitSize)); // Every touched unit has free pages now
 #endif
-
-			mask[m] &= ~(1 << b);
+			i += count;
 		}
 
+#if MEM_LOCK_FREE_PAGES
+		// Other threads claim and release pages at the same time, largestFreeRun can't be kept up to date
+		AtomicAdd(&allocator->numPagesUsed, 0u - bitCount);
+		AtomicAdd(&allocator->numPagesFree, bitCount);
+		CountPagesReturned(allocator);
+#else
 		assert(allocator->numPagesUsed != 0, __LOCATION__);
 		assert(allocator->numPagesUsed >= bitCount != 0, "underflow");
 		allocator->numPagesUsed -= bitCount;
+
+		// The released pages can join the free runs before and after them, neither of which is longer than the
+		// current bound. The new run is at most both of those plus the released pages.
+		allocator->numPagesFree += bitCount;
+		u32 largestFreeRun = allocator->largestFreeRun * 2 + bitCount;
+		if (largestFreeRun < allocator->largestFreeRun || largestFreeRun > allocator->numPagesFree) { // Overflow, or more than what's free
+			largestFreeRun = allocator->numPagesFree;
+		}
+		allocator->largestFreeRun = largestFreeRun;
+#endif
+	}
+
+#if MEM_LOCK_FREE_PAGES
+	// Clears the summary bit of a unit that has no free pages left. Another thread might have released pages of the
+	// unit, and set the summary bit, right before it was cleared here. So the unit is read again, and the bit is put
+	// back if the unit has free pages. Both threads change the masks in one total order, one of them sees the other.
+	static inline void MarkUnitFull(TrackingUnit* mask, TrackingUnit* summary, u32 m) {
+		const TrackingUnit bit = (TrackingUnit)1 << (m % TrackingUnitSize);
+		FetchAndUnit(&summary[m / TrackingUnitSize], ~bit);
+		if (LoadUnitOrdered(&mask[m]) != ~((TrackingUnit)0)) {
+			FetchOrUnit(&summary[m / TrackingUnitSize], bit);
+		}
+	}
+
+	// Marks the pages as used if all of them are free. The tracking units that the range touches are claimed one by
+	// one with a compare and swap. If another thread took one of the pages first, the units that were already
+	// claimed are given back and false is returned.
+	static inline bool ClaimRange(Allocator* allocator, u32 startBit, u32 bitCount) {
+		assert(allocator != 0, __LOCATION__);
+		assert(bitCount != 0, __LOCATION__);
+
+		TrackingUnit* mask = (TrackingUnit*)AllocatorPageMask(allocator);
+		TrackingUnit* summary = (TrackingUnit*)AllocatorSummaryMask(allocator);
+		assert(startBit + bitCount <= allocator->size / allocator->pageSize, __LOCATION__);
+		const TrackingUnit allSet = ~((TrackingUnit)0);
+
+		const u32 endBit = startBit + bitCount;
+		for (u32 i = startBit; i < endBit;) {
+			const u32 m = i / TrackingUnitSize;
+			const u32 b = i % TrackingUnitSize;
+			const u32 count = (endBit - i < TrackingUnitSize - b) ? endBit - i : TrackingUnitSize - b;
+			const TrackingUnit bits = UnitRangeMask(b, count);
+
+			TrackingUnit unit = LoadUnit(&mask[m]);
+			do {
+				if ((unit & bits) != 0) {
+					for (u32 j = startBit; j < i;) { // Give back the units that were claimed
+						const u32 claimedUnit = j / TrackingUnitSize;
+						const u32 claimedBit = j % TrackingUnitSize;
+						const u32 claimedCount = TrackingUnitSize - claimedBit; // Everything up to i was claimed
+						FetchAndUnit(&mask[claimedUnit], ~UnitRangeMask(claimedBit, claimedCount));
+						MarkUnitFree(summary, claimedUnit);
+						j += claimedCount;
+					}
+					if (i != startBit) {
+						CountPagesReturned(allocator);
+					}
+					return false;
+				}
+			} while (!CompareExchangeUnit(&mask[m], &unit, unit | bits));
+
+			if ((unit | bits) == allSet) { // This tracking unit no longer has free pages
+				MarkUnitFull(mask, summary, m);
+			}
+			i += count;
+		}
+
+		AtomicMax(&allocator->peekPagesUsed, AtomicAdd(&allocator->numPagesUsed, bitCount));
+		AtomicAdd(&allocator->numPagesFree, 0u - bitCount);
+		return true;
+	}
+#endif
+
+	static inline u32 HighestSetBit(u32 value) {
+		return TrackingUnitSize - 1 - CountLeadingZeros((TrackingUnit)value);
+	}
+
+#if MEM_PAGE_RUN_LISTS
+	static inline FreePageRun* FreePageRunAt(Allocator* allocator, u32 page) {
+		return (FreePageRun*)((u8*)allocator + (page + 1) * allocator->pageSize - sizeof(FreePageRun));
+	}
+
+	// Finds the list that a run of numPages pages belongs to
+	static inline void PageRunMapping(u32 numPages, u32* firstLevel, u32* secondLevel) {
+		if (numPages < PageRunSecondLevels) {
+			*firstLevel = 0;
+			*secondLevel = numPages;
+		}
+		else {
+			const u32 highBit = HighestSetBit(numPages);
+			*firstLevel = highBit - PageRunSecondLevelBits + 1;
+			*secondLevel = (numPages >> (highBit - PageRunSecondLevelBits)) ^ PageRunSecondLevels;
+		}
+	}
+
+	static inline void InsertFreeRun(Allocator* allocator, u32 firstPage, u32 numPages) {
+		PageRunIndex* index = (PageRunIndex*)AllocatorPageRunIndex(allocator);
+		u32 fl = 0, sl = 0;
+		PageRunMapping(numPages, &fl, &sl);
+
+		FreePageRun* run = FreePageRunAt(allocator, firstPage);
+		run->firstPage = firstPage;
+		run->numPages = numPages;
+		run->prevRun = 0;
+		run->nextRun = index->heads[fl][sl];
+		if (run->nextRun != 0) {
+			FreePageRunAt(allocator, run->nextRun)->prevRun = firstPage;
+		}
+		SetPageDescriptors(allocator, firstPage, numPages, PageKindFree, 0);
+
+		index->heads[fl][sl] = firstPage;
+		index->firstLevel |= (1 << fl);
+		index->secondLevel[fl] |= (1 << sl);
+	}
+
+	static inline void RemoveFreeRun(Allocator* allocator, u32 firstPage) {
+		PageRunIndex* index = (PageRunIndex*)AllocatorPageRunIndex(allocator);
+		FreePageRun* run = FreePageRunAt(allocator, firstPage);
+		assert(run->firstPage == firstPage, "Memory::RemoveFreeRun, corrupt free page run");
+		u32 fl = 0, sl = 0;
+		PageRunMapping(run->numPages, &fl, &sl);
+
+		if (run->prevRun != 0) {
+			FreePageRunAt(allocator, run->prevRun)->nextRun = run->nextRun;
+		}
+		else {
+			assert(index->heads[fl][sl] == firstPage, __LOCATION__);
+			index->heads[fl][sl] = run->nextRun;
+		}
+		if (run->nextRun != 0) {
+			FreePageRunAt(allocator, run->nextRun)->prevRun = run->prevRun;
+		}
+
+		if (index->heads[fl][sl] == 0) {
+			index->secondLevel[fl] &= ~(1 << sl);
+			if (index->secondLevel[fl] == 0) {
+				index->firstLevel &= ~(1 << fl);
+			}
+		}
+	}
+
+	// Returns the first page of a free run that is at least numPages long, or 0 if there isn't one. The request
+	// is rounded up to the next list, so any run in the first non empty list at or above that is big enough. If
+	// that fails, the list numPages maps to can still hold a run that is big enough. Only the first few runs of it
+	// are checked, so the search takes constant time. Lists with a first level of 0 or 1 hold runs of one size only,
+	// those are never rounded up and don't need to be checked again.
+	static inline u32 FindFreeRun(Allocator* allocator, u32 numPages) {
+		PageRunIndex* index = (PageRunIndex*)AllocatorPageRunIndex(allocator);
+
+		u32 rounded = numPages;
+		if (numPages >= PageRunSecondLevels) {
+			rounded += (1 << (HighestSetBit(numPages) - PageRunSecondLevelBits)) - 1;
+		}
+
+		u32 fl = 0, sl = 0;
+		PageRunMapping(rounded, &fl, &sl);
+
+		if (fl < PageRunFirstLevels) {
+			u32 secondLevelMap = index->secondLevel[fl] & (~0u << sl);
+			if (secondLevelMap == 0) {
+				const u32 firstLevelMap = (fl + 1 < PageRunFirstLevels) ? index->firstLevel & (~0u << (fl + 1)) : 0;
+				if (firstLevelMap != 0) {
+					fl = CountTrailingZeros(firstLevelMap);
+					secondLevelMap = index->secondLevel[fl];
+				}
+			}
+			if (secondLevelMap != 0) {
+				sl = CountTrailingZeros(secondLevelMap);
+				return index->heads[fl][sl];
+			}
+		}
+
+		PageRunMapping(numPages, &fl, &sl);
+		if (fl > 1) {
+			u32 page = index->heads[fl][sl];
+			for (u32 i = 0; i < PageRunFallbackRuns && page != 0; ++i) {
+				if (FreePageRunAt(allocator, page)->numPages >= numPages) {
+					return page;
+				}
+				page = FreePageRunAt(allocator, page)->nextRun;
+			}
+		}
+
+		return 0;
+	}
+
+	// No free run is longer than this after FindFreeRun failed to find numPages. Every list above the one numPages
+	// maps to is empty, but the runs of that list that weren't checked can be as long as the list allows.
+	static inline u32 FreeRunBoundAfterMiss(u32 numPages) {
+		if (numPages < PageRunSecondLevels * 2) {
+			return numPages - 1;
+		}
+		return numPages | ((1 << (HighestSetBit(numPages) - PageRunSecondLevelBits)) - 1);
+	}
+
+	// Returns the first page of the smallest free run that is at least numPages long, or 0 if there isn't one.
+	// Runs that map to the same list as numPages can be bigger or smaller than the request, so that list is walked
+	// for the tightest fit. If nothing there fits, every run in the next non empty list fits, and the smallest one in
+	// it is taken. Lists with a first level of 0 or 1 hold runs of one size only. Ties go to the run with the lowest
+	// address, which keeps allocations packed towards the start of memory like MEM_FIRST_FIT does.
+	static inline u32 FindBestFreeRun(Allocator* allocator, u32 numPages) {
+		PageRunIndex* index = (PageRunIndex*)AllocatorPageRunIndex(allocator);
+
+		u32 fl = 0, sl = 0;
+		PageRunMapping(numPages, &fl, &sl);
+
+		u32 bestPage = 0;
+		u32 bestPages = 0;
+		for (u32 page = index->heads[fl][sl]; page != 0; page = FreePageRunAt(allocator, page)->nextRun) {
+			const u32 runPages = FreePageRunAt(allocator, page)->numPages;
+			if (runPages >= numPages && (bestPage == 0 || runPages < bestPages || (runPages == bestPages && page < bestPage))) {
+				bestPage = page;
+				bestPages = runPages;
+			}
+		}
+		if (bestPage != 0) {
+			return bestPage;
+		}
+
+		// Find the next non empty list above the one numPages maps to
+		u32 secondLevelMap = (sl + 1 < PageRunSecondLevels) ? index->secondLevel[fl] & (~0u << (sl + 1)) : 0;
+		if (secondLevelMap == 0) {
+			const u32 firstLevelMap = (fl + 1 < PageRunFirstLevels) ? index->firstLevel & (~0u << (fl + 1)) : 0;
+			if (firstLevelMap == 0) {
+				return 0;
+			}
+			fl = CountTrailingZeros(firstLevelMap);
+			secondLevelMap = index->secondLevel[fl];
+		}
+		sl = CountTrailingZeros(secondLevelMap);
+
+		bestPage = index->heads[fl][sl];
+		if (fl > 1) {
+			bestPages = FreePageRunAt(allocator, bestPage)->numPages;
+			for (u32 page = FreePageRunAt(allocator, bestPage)->nextRun; page != 0; page = FreePageRunAt(allocator, page)->nextRun) {
+				const u32 runPages = FreePageRunAt(allocator, page)->numPages;
+				if (runPages < bestPages || (runPages == bestPages && page < bestPage)) {
+					bestPage = page;
+					bestPages = runPages;
+				}
+			}
+		}
+
+		return bestPage;
+	}
+#elif MEM_BUDDY
+	// Returns the order of the smallest block that can hold numPages
+	static inline u32 BuddyOrder(u32 numPages) {
+		u32 order = HighestSetBit(numPages);
+		if ((numPages & (numPages - 1)) != 0) {
+			order += 1;
+		}
+		return order;
+	}
+
+	// Returns how many pages the buddy block that holds numPages spans
+	static inline u32 BuddyBlockPages(u32 numPages) {
+		return 1u << BuddyOrder(numPages);
+	}
+
+	static inline u8* BuddyOrderTable(Allocator* allocator) {
+		return AllocatorPageRunIndex(allocator) + sizeof(BuddyIndex);
+	}
+
+	static inline BuddyBlock* BuddyBlockAt(Allocator* allocator, u32 page) {
+		return (BuddyBlock*)((u8*)allocator + (page + 1) * allocator->pageSize - sizeof(BuddyBlock));
+	}
+
+	static inline void InsertBuddyBlock(Allocator* allocator, u32 page, u32 order) {
+		BuddyIndex* index = (BuddyIndex*)AllocatorPageRunIndex(allocator);
+		BuddyBlock* block = BuddyBlockAt(allocator, page);
+		block->prevBlock = 0;
+		block->nextBlock = index->heads[order];
+		if (block->nextBlock != 0) {
+			BuddyBlockAt(allocator, block->nextBlock)->prevBlock = page;
+		}
+
+		index->heads[order] = page;
+		index->nonEmpty |= (1u << order);
+		BuddyOrderTable(allocator)[page] = (u8)(order + 1);
+	}
+
+	static inline void RemoveBuddyBlock(Allocator* allocator, u32 page, u32 order) {
+		BuddyIndex* index = (BuddyIndex*)AllocatorPageRunIndex(allocator);
+		BuddyBlock* block = BuddyBlockAt(allocator, page);
+		assert(BuddyOrderTable(allocator)[page] == order + 1, "Memory::RemoveBuddyBlock, corrupt buddy block");
+
+		if (block->prevBlock != 0) {
+			BuddyBlockAt(allocator, block->prevBlock)->nextBlock = block->nextBlock;
+		}
+		else {
+			assert(index->heads[order] == page, __LOCATION__);
+			index->heads[order] = block->nextBlock;
+		}
+		if (block->nextBlock != 0) {
+			BuddyBlockAt(allocator, block->nextBlock)->prevBlock = block->prevBlock;
+		}
+
+		if (index->heads[order] == 0) {
+			index->nonEmpty &= ~(1u << order);
+		}
+		BuddyOrderTable(allocator)[page] = 0;
+	}
+
+	// Splits the pages into the biggest aligned blocks that fit, and merges each block with its buddy for as
+	// long as the buddy is free and of the same order.
+	static inline void ReleaseBuddyBlocks(Allocator* allocator, u32 firstPage, u32 numPages) {
+		const u8* orderTable = BuddyOrderTable(allocator);
+		const u32 numPagesInMemory = allocator->size / allocator->pageSize;
+
+		while (numPages > 0) {
+			u32 order = CountTrailingZeros((TrackingUnit)firstPage); // Page 0 is always used, so firstPage isn't 0
+			while ((1u << order) > numPages) {
+				order -= 1;
+			}
+
+			u32 block = firstPage;
+			u32 blockOrder = order;
+			while (blockOrder + 1 < BuddyMaxOrders) {
+				const u32 buddy = block ^ (1u << blockOrder);
+				if (buddy >= numPagesInMemory || orderTable[buddy] != blockOrder + 1) {
+					break;
+				}
+				RemoveBuddyBlock(allocator, buddy, blockOrder);
+				block &= buddy;
+				blockOrder += 1;
+			}
+			InsertBuddyBlock(allocator, block, blockOrder);
+
+			firstPage += 1u << order;
+			numPages -= 1u << order;
+		}
+	}
+
+	// Takes the smallest free block that can hold numPages, and splits it down to the smallest power of two that
+	// can. The halves that are split off go back on the free lists. Returns the first page, or 0 if there is no
+	// block that is big enough. The whole block is used, even if numPages is not a power of two.
+	static inline u32 AllocateBuddyBlock(Allocator* allocator, u32 numPages) {
+		BuddyIndex* index = (BuddyIndex*)AllocatorPageRunIndex(allocator);
+
+		const u32 order = BuddyOrder(numPages);
+		if (order >= BuddyMaxOrders) {
+			return 0;
+		}
+
+		const u32 available = index->nonEmpty & (~0u << order);
+		if (available == 0) {
+			return 0;
+		}
+
+		u32 blockOrder = CountTrailingZeros(available);
+		const u32 block = index->heads[blockOrder];
+		RemoveBuddyBlock(allocator, block, blockOrder);
+		while (blockOrder > order) {
+			blockOrder -= 1;
+			InsertBuddyBlock(allocator, block + (1u << blockOrder), blockOrder);
+		}
+
+		return block;
+	}
+#endif
+
+	// Upper bound on how many pages a single allocation can get. With MEM_LOCK_FREE_PAGES only the number of free
+	// pages is known.
+	static inline u32 LargestFreeRunBound(Allocator* allocator) {
+#if MEM_LOCK_FREE_PAGES
+		return AtomicLoad(&allocator->numPagesFree);
+#else
+		return allocator->largestFreeRun;
+#endif
+	}
+
+	// Reserves numPages contiguous pages for arena, marks them as used and describes them with kind and sizeClass.
+	// Returns the first page, or 0 on failure. With MEM_THREAD_SAFE, the caller holds the page lock (see LockPages),
+	// same for ReleasePages.
+	static inline u32 AllocatePages(Allocator* allocator, Arena* arena, u32 numPages, u8 kind, u8 sizeClass) {
+#if MEM_BUDDY
+		numPages = BuddyBlockPages(numPages); // The pages past the end of the request are still part of the block
+#endif
+		// Requests that can't fit fail without searching
+		if (numPages > LargestFreeRunBound(allocator)) {
+			assert(false, "Memory::AllocatePages Could not find enough memory to fufill request");
+			return 0;
+		}
+
+#if MEM_PAGE_RUN_LISTS
+	#if MEM_BEST_FIT
+		const u32 firstPage = FindBestFreeRun(allocator, numPages);
+	#else
+		const u32 firstPage = FindFreeRun(allocator, numPages);
+	#endif
+		assert(firstPage != 0, "Memory::AllocatePages Could not find enough memory to fufill request");
+		if (firstPage != 0) {
+			// Take the front of the run, and put whatever is left back into the index
+			const u32 runPages = FreePageRunAt(allocator, firstPage)->numPages;
+			assert(runPages >= numPages, __LOCATION__);
+			RemoveFreeRun(allocator, firstPage);
+			if (runPages > numPages) {
+				InsertFreeRun(allocator, firstPage + numPages, runPages - numPages);
+			}
+		}
+#elif MEM_BUDDY
+		const u32 firstPage = AllocateBuddyBlock(allocator, numPages);
+		assert(firstPage != 0, "Memory::AllocatePages Could not find enough memory to fufill request");
+#elif MEM_LOCK_FREE_PAGES
+		// Another thread can claim some of the pages between the search and the claim. Then the search starts over,
+		// until a claim works, or no free run is found. A search can also miss a run because pages were released, or
+		// held for a moment by a claim that failed, while it ran. It's only a real failure if no pages were given
+		// back during the search, or if there aren't enough free pages left.
+		u32 firstPage = 0;
+		for (;;) {
+			const u32 pagesReturned = LoadPagesReturned(allocator);
+			do {
+				firstPage = FindRange(allocator, numPages, MEM_FIRST_FIT ? 0 : AtomicLoad(&arena->scanBit));
+			} while (firstPage != 0 && !ClaimRange(allocator, firstPage, numPages));
+
+			if (firstPage != 0 || AtomicLoad(&allocator->numPagesFree) < numPages || LoadPagesReturned(allocator) == pagesReturned) {
+				break;
+			}
+		}
+		assert(firstPage != 0, "Memory::AllocatePages Could not find enough memory to fufill request");
+#elif MEM_FIRST_FIT
+		const u32 firstPage = FindRange(allocator, numPages, 0);
+		assert(firstPage != 0, "Memory::AllocatePages Could not find enough memory to fufill request");
+#else
+		const u32 firstPage = FindRange(allocator, numPages, arena->scanBit);
+		assert(firstPage != 0, "Memory::AllocatePages Could not find enough memory to fufill request");
+#endif
+		if (firstPage == 0) {
+			// The other backends search all free memory before failing, so nothing this big or bigger can be found.
+			// Without the page lock, pages can be released while the search runs, so the bound is left alone.
+#if MEM_BUDDY
+			allocator->largestFreeRun = numPages / 2;
+#elif MEM_TLSF
+			allocator->largestFreeRun = FreeRunBoundAfterMiss(numPages);
+#elif !MEM_LOCK_FREE_PAGES
+			allocator->largestFreeRun = numPages - 1;
+#endif
+			return 0;
+		}
+
+#if !MEM_LOCK_FREE_PAGES
+		SetRange(allocator, firstPage, numPages);
+#endif
+#if !MEM_FIRST_FIT && !MEM_PAGE_RUN_LISTS && !MEM_BUDDY
+		AtomicStore(&arena->scanBit, firstPage + numPages); // The next search of the arena starts after this run
+#endif
+		SetPageDescriptors(allocator, firstPage, numPages, kind, sizeClass);
+		PageDescriptor* descriptors = AllocatorPageDescriptors(allocator);
+		descriptors[firstPage].arena = (u16)arena->index;
+		descriptors[firstPage + numPages - 1].arena = (u16)arena->index;
+		return firstPage;
+	}
+
+	// Marks the pages as free. In TLSF and best fit mode, the run is merged with the free runs on either side of it, and
+	// the page descriptors tell us if there are such runs. The page after the run might be past the end of memory.
+	// In buddy mode, the whole block that held the pages is merged with its buddy blocks instead. The descriptors are
+	// written first, with MEM_LOCK_FREE_PAGES the pages belong to whoever claims them once they are cleared.
+	static inline void ReleasePages(Allocator* allocator, u32 firstPage, u32 numPages) {
+#if MEM_BUDDY
+		numPages = BuddyBlockPages(numPages);
+#endif
+		SetPageDescriptors(allocator, firstPage, numPages, PageKindFree, 0);
+		ClearRange(allocator, firstPage, numPages);
+
+#if MEM_PAGE_RUN_LISTS
+		const PageDescriptor* descriptors = AllocatorPageDescriptors(allocator);
+		const u32 numPagesInMemory = allocator->size / allocator->pageSize;
+
+		const PageDescriptor* prev = &descriptors[firstPage - 1]; // Page 0 is always used, so this can't underflow
+		if (prev->kind == PageKindFree) {
+			const u32 prevRun = prev->runStart;
+			const u32 prevPages = prev->runLength;
+			assert(prevRun + prevPages == firstPage, "Memory::ReleasePages, corrupt free page run");
+			RemoveFreeRun(allocator, prevRun);
+			firstPage = prevRun;
+			numPages += prevPages;
+		}
+
+		const u32 nextPage = firstPage + numPages;
+		if (nextPage < numPagesInMemory && descriptors[nextPage].kind == PageKindFree) {
+			const u32 nextPages = descriptors[nextPage].runLength;
+			assert(descriptors[nextPage].runStart == nextPage, "Memory::ReleasePages, corrupt free page run");
+			RemoveFreeRun(allocator, nextPage);
+			numPages += nextPages;
+		}
+
+		InsertFreeRun(allocator, firstPage, numPages);
+#elif MEM_BUDDY
+		ReleaseBuddyBlocks(allocator, firstPage, numPages);
+#endif
 	}
 
 #if MEM_USE_SUBALLOCATORS
-	// This function will chop the provided page into several blocks. Since the block size is constant, we
-	// know that headers will be laid out at a stride of blockSize. There is no additional tracking needed.
-	void* SubAllocate(u32 requestedBytes, u32 blockSize, Allocation** freeList, const char* location, Allocator* allocator) {
-		assert(blockSize < allocator->pageSize, "Block size must be less than page size");
-
-		// There is no blocks of the requested size available. Reserve 1 page, and carve it up into blocks.
-		bool grabNewPage = *freeList == 0;
-		if (*freeList == 0) {
-			// Find and reserve 1 free page
-#if MEM_FIRST_FIT
-			const u32 page = FindRange(allocator, 1, 0);
+	// Size classes are multiples of 8, so every size rounded up to a multiple of 8 maps to one class. SizeClassLookup 
+	// has an entry for every multiple of 8 up to the largest class, entry i holds the smallest class that fits i * 8 bytes.
+	// Blocks of a class are aligned to the largest power of two its size is a multiple of, as long as the allocator
+	// memory is aligned at least that much. There is a table for each alignment from 8 to SlabMaxAlignment bytes, which
+	// only has the classes with blocks that are aligned well. Entries that no class can serve are NumSizeClasses.
+	// The tables are built at compile time from MEM_SIZE_CLASSES, they are 2049 bytes each with the default classes.
+	const u32 SizeClassLookupSize = SizeClasses[NumSizeClasses - 1] / 8 + 1;
+	const u32 SlabMaxAlignment = 64;
+	const u32 SizeClassAlignments = 4; // 8, 16, 32 and 64 bytes
+
+	struct SizeClassLookup {
+		u8 sizeClass[SizeClassAlignments][SizeClassLookupSize];
+	};
+
+	static constexpr SizeClassLookup MakeSizeClassLookup() {
+		SizeClassLookup lookup = {};
+		for (u32 a = 0; a < SizeClassAlignments; ++a) {
+			const u32 alignment = 8u << a;
+			u32 sizeClass = 0;
+			for (u32 i = 0; i < SizeClassLookupSize; ++i) {
+				while (sizeClass < NumSizeClasses && (SizeClasses[sizeClass] < i * 8 || SizeClasses[sizeClass] % alignment != 0)) {
+					sizeClass += 1;
+				}
+				lookup.sizeClass[a][i] = (u8)sizeClass;
+			}
+		}
+		return lookup;
+	}
+
+	static constexpr SizeClassLookup SizeClassTable = MakeSizeClassLookup();
+
+	// Checks the table of one alignment against a linear scan of MEM_SIZE_CLASSES, for every size up to the largest
+	// class, the way FindAlignedSizeClass indexes it. Each table is checked on its own, to stay in the compiler's
+	// limit for how much work a constant expression can do.
+	static constexpr bool SizeClassTableMatchesScan(u32 a) {
+		const u32 alignment = 8u << a;
+		for (u32 bytes = 0; bytes <= SizeClasses[NumSizeClasses - 1]; ++bytes) {
+			u32 sizeClass = 0;
+			while (sizeClass < NumSizeClasses && (SizeClasses[sizeClass] < bytes || SizeClasses[sizeClass] % alignment != 0)) {
+				sizeClass += 1;
+			}
+			if (SizeClassTable.sizeClass[a][(bytes + 7) / 8] != sizeClass) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static_assert (SizeClassAlignments == 4, "Memory::SizeClassTableMatchesScan needs to check every alignment");
+	static_assert (SizeClassTableMatchesScan(0), "Memory::SizeClassTable doesn't pick the smallest size class for every size");
+	static_assert (SizeClassTableMatchesScan(1), "Memory::SizeClassTable doesn't pick the smallest 16 byte aligned size class for every size");
+	static_assert (SizeClassTableMatchesScan(2), "Memory::SizeClassTable doesn't pick the smallest 32 byte aligned size class for every size");
+	static_assert (SizeClassTableMatchesScan(3), "Memory::SizeClassTable doesn't pick the smallest 64 byte aligned size class for every size");
+
+	// Returns the index of the smallest size class that can hold an allocation of bytes, or NumSizeClasses if the
+	// allocation is too big for the sub-allocators.
+	static inline u32 FindSizeClass(u32 bytes) {
+		const u32 index = (bytes + 7) / 8;
+		if (index >= SizeClassLookupSize) {
+			return NumSizeClasses;
+		}
+		return SizeClassTable.sizeClass[0][index];
+	}
+
+	// Same as FindSizeClass, but only returns classes that have blocks aligned to alignment. Alignments of 8 bytes
+	// or less are always met. Larger alignments need to be a power of two, and the allocator memory and page size
+	// must be aligned to them.
+	static inline u32 FindAlignedSizeClass(Allocator* allocator, u32 bytes, u32 alignment) {
+		if (alignment <= 8) {
+			return FindSizeClass(bytes);
+		}
+		const u32 index = (bytes + 7) / 8;
+		if (alignment > SlabMaxAlignment || (alignment & (alignment - 1)) != 0 || index >= SizeClassLookupSize) {
+			return NumSizeClasses;
+		}
+		if (((ptr_type)allocator % alignment) != 0 || allocator->pageSize % alignment != 0) {
+			return NumSizeClasses;
+		}
+		return SizeClassTable.sizeClass[CountTrailingZeros(alignment) - 3][index];
+	}
+
+	// Every slab keeps a list of its free blocks, and a count of its allocated blocks, in its page descriptor. The
+	// slabs of a size class that have free blocks are linked through their descriptors, starting at partialSlabs of
+	// the arena that owns them.
+	static inline void AddPartialSlab(Allocator* allocator, Arena* arena, u32 sizeClass, u32 slab) {
+		PageDescriptor* descriptors = AllocatorPageDescriptors(allocator);
+		const u32 head = arena->sizeClasses[sizeClass].partialSlabs;
+		descriptors[slab].prevSlab = 0;
+		descriptors[slab].nextSlab = head;
+		if (head != 0) {
+			descriptors[head].prevSlab = slab;
+		}
+		arena->sizeClasses[sizeClass].partialSlabs = slab;
+	}
+
+	static inline void RemovePartialSlab(Allocator* allocator, Arena* arena, u32 sizeClass, u32 slab) {
+		PageDescriptor* descriptors = AllocatorPageDescriptors(allocator);
+		PageDescriptor* descriptor = &descriptors[slab];
+		if (descriptor->prevSlab != 0) {
+			descriptors[descriptor->prevSlab].nextSlab = descriptor->nextSlab;
+		}
+		else {
+			assert(arena->sizeClasses[sizeClass].partialSlabs == slab, "Memory::RemovePartialSlab, slab is not in the list");
+			arena->sizeClasses[sizeClass].partialSlabs = descriptor->nextSlab;
+		}
+		if (descriptor->nextSlab != 0) {
+			descriptors[descriptor->nextSlab].prevSlab = descriptor->prevSlab;
+		}
+		descriptor->prevSlab = 0;
+		descriptor->nextSlab = 0;
+	}
+
+	// Blocks that divide the page evenly, or almost evenly, are carved from a single page. Bigger blocks are carved from a
+	// span of the fewest pages that wastes no more than an eighth of the span. In buddy mode spans are a power of two
+	// pages, anything else would be rounded up anyway. Every page of a span has a descriptor that points to the first
+	// page, which holds the state of the slab.
+	static inline u32 SlabPages(Allocator* allocator, u32 blockSize) {
+		u32 numPages = 1;
+		while (numPages * allocator->pageSize < blockSize || (numPages * allocator->pageSize) % blockSize > numPages * allocator->pageSize / 8) {
+#if MEM_BUDDY
+			numPages *= 2;
 #else
-			const u32 page = FindRange(allocator, 1, allocator->scanBit);
+			numPages += 1;
 #endif
-			SetRange(allocator, page, 1);
+		}
+		return numPages;
+	}
+
+	// Gives the pages of an empty slab back. The descriptors of the pages inside of the span are marked free,
+	// ReleasePages takes care of the first and last page.
+	static inline void ReleaseSlab(Allocator* allocator, Arena* arena, u32 sizeClass, u32 slab) {
+		PageDescriptor* descriptors = AllocatorPageDescriptors(allocator);
+		const u32 numPages = descriptors[slab].runLength;
+		RemovePartialSlab(allocator, arena, sizeClass, slab);
+		LockPages(allocator);
+		for (u32 i = 1; i + 1 < numPages; ++i) {
+			descriptors[slab + i].kind = PageKindFree;
+		}
+		ReleasePages(allocator, slab, numPages);
+		UnlockPages(allocator);
+	}
 
-			// Zero out the pages memory
-			u8* mem = (u8*)allocator + allocator->pageSize * page;
-			Set(mem, 0, allocator->pageSize, __LOCATION__);
+	// Small allocations don't have a header. A released block is pushed onto a stack of released blocks in its slab,
+	// the link to the next block is stored in the first bytes of the block. Pushing and popping only touches the block
+	// and the head in the page descriptor, blocks never have to be unlinked from the middle of the stack.
+	struct FreeBlock {
+		Offset32 nextOffset; // Offsets are the number of bytes from allocator
+	};
 
-			// Figure out how many blocks fit into this page
-			const u32 numBlocks = allocator->pageSize / blockSize;
-			assert(numBlocks > 0, __LOCATION__);
-			assert(numBlocks < 128, __LOCATION__);
+	static inline void PushFreeBlock(Allocator* allocator, PageDescriptor* slab, FreeBlock* block) {
+		block->nextOffset = slab->freeBlocks;
+		slab->freeBlocks = (u32)((u8*)block - (u8*)allocator);
+	}
 
-			// For each block in this page, initialize it's header and add it to the free list
-			for (u32 i = 0; i < numBlocks; ++i) {
-				Allocation* alloc = (Allocation*)mem;
-				mem += blockSize;
+	static inline FreeBlock* PopFreeBlock(Allocator* allocator, PageDescriptor* slab) {
+		assert(slab->freeBlocks != 0, "Memory::PopFreeBlock, slab has no free blocks");
+		FreeBlock* block = (FreeBlock*)((u8*)allocator + slab->freeBlocks);
+		slab->freeBlocks = block->nextOffset;
+		return block;
+	}
 
-				// Initialize the allocation header
-				alloc->prevOffset = 0;
-				alloc->nextOffset = 0;
-				alloc->size = 0;
-				alloc->alignment = 0;
-#if MEM_TRACK_LOCATION
-				alloc->location = location;
+	// Takes one block of sizeClass out of the slabs of arena, the caller holds the lock of the size class in the
+	// arena. If no slab has a free block, the pages for a new slab are reserved first. Since the block size is
+	// constant, and the page descriptor of the slab knows its size class, blocks don't need a header. A new slab
+	// isn't touched up front, its blocks are handed out in address order, and only blocks that have been released
+	// go trough the free list of the slab. slab is set to the first page of the slab, and numPages to how many pages
+	// were reserved for it, or 0 if the slab already existed. Returns 0 if there is no memory left.
+	static inline u8* TakeBlock(Allocator* allocator, Arena* arena, u32 sizeClass, u32* slabOut, u32* numPagesOut) {
+		const u32 blockSize = SizeClasses[sizeClass];
+		PageDescriptor* descriptors = AllocatorPageDescriptors(allocator);
+
+		// There is no blocks of the requested size available. Reserve the pages for a new slab.
+		u32 slab = arena->sizeClasses[sizeClass].partialSlabs;
+		u32 numPages = 0;
+		if (slab == 0) {
+			// Find and reserve enough pages for a span of blocks
+			numPages = SlabPages(allocator, blockSize);
+			LockPages(allocator);
+			slab = AllocatePages(allocator, arena, numPages, PageKindSlab, (u8)sizeClass);
+			UnlockPages(allocator);
+			if (slab == 0) {
+				return 0;
+			}
+
+			PageDescriptor* descriptor = &descriptors[slab];
+			descriptor->liveBlocks = 0;
+			descriptor->freeBlocks = 0;
+			descriptor->carvedBlocks = 0;
+			for (u32 i = 1; i + 1 < numPages; ++i) { // AllocatePages described the first and last page
+				descriptors[slab + i] = *descriptor;
+			}
+			AddPartialSlab(allocator, arena, sizeClass, slab);
+		}
+
+		// Figure out how many blocks fit into the slab
+		PageDescriptor* descriptor = &descriptors[slab];
+		assert(descriptor->kind == PageKindSlab && descriptor->sizeClass == sizeClass && descriptor->arena == arena->index, "Memory::TakeBlock, corrupt slab");
+		const u32 numBlocks = descriptor->runLength * allocator->pageSize / blockSize;
+		assert(numBlocks > 0, __LOCATION__);
+
+		// At this point we know the slab has some number of free blocks in it. Reuse a released block if there
+		// is one, otherwise carve the next one. If that was the last free block, the slab leaves the list of
+		// partial slabs.
+		u8* block = 0;
+		if (descriptor->freeBlocks != 0) {
+			block = (u8*)PopFreeBlock(allocator, descriptor);
+		}
+		else {
+			assert(descriptor->carvedBlocks < numBlocks, "Memory::TakeBlock, full slab in the list of partial slabs");
+			block = (u8*)allocator + allocator->pageSize * slab + descriptor->carvedBlocks * blockSize;
+			descriptor->carvedBlocks += 1;
+		}
+		if (descriptor->liveBlocks == 0 && numPages == 0) { // A slab that was kept around is no longer empty
+			assert(arena->sizeClasses[sizeClass].emptySlabs > 0, "Memory::TakeBlock, empty slab was not counted");
+			arena->sizeClasses[sizeClass].emptySlabs -= 1;
+		}
+		descriptor->liveBlocks += 1;
+		if (descriptor->liveBlocks == numBlocks) {
+			RemovePartialSlab(allocator, arena, sizeClass, slab);
+		}
+
+		*slabOut = slab;
+		*numPagesOut = numPages;
+		return block;
+	}
+
+	// Puts a block back into its slab, the caller holds the lock of the size class in arena, which owns the slab.
+	// slab is set to the first page of the slab. Returns how many pages were released, 0 if the slab still has
+	// allocated blocks, or is kept around.
+	static inline u32 ReturnBlock(Allocator* allocator, Arena* arena, u32 sizeClass, void* memory, u32* slabOut) {
+		const u32 blockSize = SizeClasses[sizeClass];
+
+		// The block can be on any page of the slab, all of them know which page the slab starts at
+		const u32 memoryPage = (u32)((u8*)memory - (u8*)allocator) / allocator->pageSize;
+		const u32 slab = AllocatorPageDescriptors(allocator)[memoryPage].runStart;
+		PageDescriptor* descriptor = &AllocatorPageDescriptors(allocator)[slab];
+		assert(descriptor->kind == PageKindSlab && descriptor->sizeClass == sizeClass && descriptor->arena == arena->index, "Memory::ReturnBlock, corrupt slab");
+		assert(descriptor->liveBlocks > 0, "Memory::ReturnBlock, slab has no allocated blocks");
+#if _DEBUG
+		const u32 blockOffset = (u32)((u8*)memory - (u8*)allocator) - slab * allocator->pageSize;
+		assert(blockOffset % blockSize == 0 && blockOffset / blockSize < descriptor->carvedBlocks, "Memory::ReturnBlock, pointer is not an allocated block");
+
+		// Blocks don't have a header to mark them as free. In debug mode only, look for the block in the free list.
+		for (u32 offset = descriptor->freeBlocks; offset != 0; offset = ((FreeBlock*)((u8*)allocator + offset))->nextOffset) {
+			assert((u8*)allocator + offset != (u8*)memory, "Double Free!");
+		}
+#endif
+
+		// Add memory back into the free list of its slab. If the slab was full, it has a free block now.
+		const u32 numPages = descriptor->runLength;
+		const bool wasFull = descriptor->liveBlocks == numPages * allocator->pageSize / blockSize;
+		PushFreeBlock(allocator, descriptor, (FreeBlock*)memory);
+		if (wasFull) {
+			AddPartialSlab(allocator, arena, sizeClass, slab);
+		}
+
+		// If none of the blocks in the slab are allocated, its pages are released, unless the size class keeps
+		// it around for the next allocation. All of its free blocks go with it, so it only has to leave the list
+		// of partial slabs.
+		*slabOut = slab;
+		descriptor->liveBlocks -= 1;
+		if (descriptor->liveBlocks == 0) {
+			if (arena->sizeClasses[sizeClass].emptySlabs < MEM_KEEP_EMPTY_SLABS) {
+				arena->sizeClasses[sizeClass].emptySlabs += 1;
+			}
+			else {
+				ReleaseSlab(allocator, arena, sizeClass, slab);
+				return numPages;
+			}
+		}
+		return 0;
+	}
+
+#if MEM_THREAD_CACHE
+	// Every thread keeps a few blocks of each size class for one allocator. Taking a block from the cache, or putting
+	// one back, only touches memory of the thread, so it doesn't need a lock or an atomic. An empty cache is refilled
+	// with half of its capacity under one lock of the size class, and a full cache gives half of its blocks back the
+	// same way. Blocks in a cache are linked through their first bytes, like the free blocks of a slab. They count as
+	// allocated in their slab, and their size counts towards requested of their size class, in the arena that owns
+	// the slab. A cache is bound to the first allocator the thread uses, it's unbound once all of its blocks are given
+	// back. Other allocators skip the cache. The cache is refilled from the arena of the thread, but it also holds
+	// blocks of other arenas that the thread released, those go back to their own arena. When the thread exits, the
+	// destructor of the cache gives its blocks back.
+	const u32 ThreadCacheBytes = 64 * 1024; // The most memory a thread keeps cached for one size class
+
+	struct ThreadCache {
+		Allocator* allocator;
+		Offset32 blocks[NumSizeClasses];	// Offsets are the number of bytes from allocator, 0 if empty
+		u16 numBlocks[NumSizeClasses];
+
+		~ThreadCache();
+	};
+
+	static thread_local ThreadCache threadCache;
+
+	// How many blocks of a size class a thread can keep, at most MEM_THREAD_CACHE_BLOCKS, at least 2
+	static inline u32 ThreadCacheCapacity(u32 sizeClass) {
+		const u32 capacity = ThreadCacheBytes / SizeClasses[sizeClass];
+		return capacity > MEM_THREAD_CACHE_BLOCKS ? MEM_THREAD_CACHE_BLOCKS : (capacity < 2 ? 2 : capacity);
+	}
+
+	// Moves half of the capacity of the cache from the slabs of sizeClass in the arena of the thread into the cache.
+	// Returns false if not a single block could be taken. numPages is set to how many pages were reserved for new slabs.
+	static inline bool FillThreadCache(Allocator* allocator, ThreadCache* cache, u32 sizeClass, u32* numPagesOut) {
+		const u32 batch = ThreadCacheCapacity(sizeClass) / 2;
+		Arena* arena = ThreadArena(allocator);
+		u32 numTaken = 0;
+		u32 numPages = 0;
+
+		Lock(&arena->sizeClasses[sizeClass].lock);
+		for (; numTaken < batch; ++numTaken) {
+			u32 slab = 0;
+			u32 slabPages = 0;
+			FreeBlock* block = (FreeBlock*)TakeBlock(allocator, arena, sizeClass, &slab, &slabPages);
+			if (block == 0) {
+				break;
+			}
+			block->nextOffset = cache->blocks[sizeClass];
+			cache->blocks[sizeClass] = (u32)((u8*)block - (u8*)allocator);
+			numPages += slabPages;
+		}
+		Unlock(&arena->sizeClasses[sizeClass].lock);
+
+		cache->numBlocks[sizeClass] += (u16)numTaken;
+		AtomicAdd(&arena->sizeClasses[sizeClass].requested, numTaken * SizeClasses[sizeClass]);
+		*numPagesOut = numPages;
+		return numTaken != 0;
+	}
+
+	// Gives every block of sizeClass after the first keep blocks of the cache back to their slabs. The blocks
+	// that were cached last stay, they are the most likely to still be in the CPU cache. Blocks are given back
+	// under the lock of the arena that owns them, the lock is only switched when the arena changes. Returns how
+	// many pages were released.
+	static inline u32 ReturnCachedBlocks(Allocator* allocator, ThreadCache* cache, u32 sizeClass, u32 keep) {
+		if (cache->numBlocks[sizeClass] <= keep) {
+			return 0;
+		}
+		const u32 numReturned = cache->numBlocks[sizeClass] - keep;
+
+		// Find the first block that goes back, and cut the list before it
+		Offset32* link = &cache->blocks[sizeClass];
+		for (u32 i = 0; i < keep; ++i) {
+			link = &((FreeBlock*)((u8*)allocator + *link))->nextOffset;
+		}
+		u32 offset = *link;
+		*link = 0;
+		cache->numBlocks[sizeClass] = (u16)keep;
+
+		u32 numPages = 0;
+		Arena* locked = 0;
+		u32 numLocked = 0; // Blocks given back to the locked arena
+		while (offset != 0) {
+			FreeBlock* block = (FreeBlock*)((u8*)allocator + offset);
+			offset = block->nextOffset;
+
+			Arena* arena = ArenaOfPage(allocator, (u32)((u8*)block - (u8*)allocator) / allocator->pageSize);
+			if (arena != locked) {
+				if (locked != 0) {
+					Unlock(&locked->sizeClasses[sizeClass].lock);
+					AtomicAdd(&locked->sizeClasses[sizeClass].requested, 0u - numLocked * SizeClasses[sizeClass]);
+				}
+				Lock(&arena->sizeClasses[sizeClass].lock);
+				locked = arena;
+				numLocked = 0;
+			}
+
+			u32 slab = 0;
+			numPages += ReturnBlock(allocator, arena, sizeClass, block, &slab);
+			numLocked += 1;
+		}
+		if (locked != 0) {
+			Unlock(&locked->sizeClasses[sizeClass].lock);
+			AtomicAdd(&locked->sizeClasses[sizeClass].requested, 0u - numLocked * SizeClasses[sizeClass]);
+		}
+		return numPages;
+	}
+
+	// Runs when the thread exits. The allocator the cache is bound to has to still be alive.
+	ThreadCache::~ThreadCache() {
+		if (allocator == 0) {
+			return;
+		}
+		for (u32 sizeClass = 0; sizeClass < NumSizeClasses; ++sizeClass) {
+			ReturnCachedBlocks(allocator, this, sizeClass, 0);
+		}
+		allocator = 0;
+	}
 #endif
 
-				AddtoList(allocator, freeList, alloc);
+	void* SubAllocate(u32 requestedBytes, u32 sizeClass, const char* location, Allocator* allocator) {
+		assert(sizeClass < NumSizeClasses, "Memory::SubAllocate, invalid size class");
+		const u32 blockSize = SizeClasses[sizeClass];
+
+		u8* block = 0;
+		u32 slab = 0;
+		u32 numPages = 0;
+#if MEM_THREAD_CACHE
+		ThreadCache* cache = &threadCache;
+		if (cache->allocator == allocator || cache->allocator == 0) {
+			if (cache->blocks[sizeClass] == 0 && !FillThreadCache(allocator, cache, sizeClass, &numPages)) {
+				assert(false, __LOCATION__);
+				return 0;
+			}
+			cache->allocator = allocator;
+
+			FreeBlock* cached = (FreeBlock*)((u8*)allocator + cache->blocks[sizeClass]);
+			cache->blocks[sizeClass] = cached->nextOffset;
+			cache->numBlocks[sizeClass] -= 1;
+			block = (u8*)cached;
+			if (allocator->allocateCallback != 0) {
+				slab = AllocatorPageDescriptors(allocator)[(u32)(block - (u8*)allocator) / allocator->pageSize].runStart;
+			}
+		}
+		else
+#endif
+		{
+			Arena* arena = ThreadArena(allocator);
+			Lock(&arena->sizeClasses[sizeClass].lock);
+			block = TakeBlock(allocator, arena, sizeClass, &slab, &numPages);
+			Unlock(&arena->sizeClasses[sizeClass].lock);
+			if (block == 0) {
+				assert(false, __LOCATION__);
+				return 0;
 			}
+
+			// Blocks don't remember how many bytes were requested, so they are accounted for at the block size
+			AtomicAdd(&arena->sizeClasses[sizeClass].requested, blockSize);
 		}
-		assert(*freeList != 0, "The free list literally can't be zero here...");
 
-		// At this point we know the free list has some number of blocks in it. 
-		// Save a reference to the current header & advance the free list
-		// Advance the free list, we're going to be using this one.
-		Allocation* block = *freeList;
 #if MEM_CLEAR_ON_ALLOC
-		Set((u8*)block + sizeof(Allocation), 0, blockSize - sizeof(Allocation), location);
+		Set(block, 0, blockSize, location);
 #elif MEM_DEBUG_ON_ALLOC
 		{
 			const u8 stamp[] = "-MEMORY-";
-			u8* mem = (u8*)block + sizeof(Allocation);
-			u32 size = blockSize - sizeof(Allocation);
-			for (u32 i = requestedBytes; i < size; ++i) {
-				mem[i] = stamp[(i - requestedBytes) % 7];
+			for (u32 i = requestedBytes; i < blockSize; ++i) {
+				block[i] = stamp[(i - requestedBytes) % 7];
 			}
 		}
 #endif
-		if ((*freeList)->nextOffset != 0) { // Advance one
-			Allocation* _next = (Allocation*)((u8*)allocator + (*freeList)->nextOffset);
-			_next->prevOffset = 0;
-			*freeList = (Allocation*)((u8*)allocator + (*freeList)->nextOffset); // freeList = freeList.next
-		}
-		else {
-			*freeList = 0;
-		}
-
-		block->prevOffset = 0;
-		block->size = requestedBytes;
-		block->alignment = 0;
-#if MEM_TRACK_LOCATION
-		block->location = location;
-#endif
-
-		AddtoList(allocator, &allocator->active, block); // Sets block->next
 
 		if (allocator->allocateCallback != 0) {
-			u32 firstPage = ((u32)((u8*)block - (u8*)allocator)) / allocator->pageSize;
-			allocator->allocateCallback(allocator, block, requestedBytes, blockSize, firstPage, grabNewPage? 1 : 0);
+			allocator->allocateCallback(allocator, block, requestedBytes, blockSize, slab, numPages);
 		}
 
-		// Memory always follows the header
-		return (u8*)block + sizeof(Allocation);
+		return block;
 	}
-#endif
 
-#if MEM_USE_SUBALLOCATORS
-	void SubRelease(void* memory, u32 blockSize, Allocation** freeList, const char* location, Allocator* allocator) {
-		// Find the allocation header and mark it as free. Early out on double free to avoid breaking.
-		Allocation* header = (Allocation*)((u8*)memory - sizeof(Allocation));
-		assert(header->size != 0, "Double Free!"); // Make sure it's not a double free
-		if (header->size == 0) {
-			assert(false, __LOCATION__);
-			return;
-		}
-		u32 oldSize = header->size;
-		header->size = 0;
+	void SubRelease(void* memory, u32 sizeClass, const char* location, Allocator* allocator) {
+		assert(sizeClass < NumSizeClasses, "Memory::SubRelease, invalid size class");
+		const u32 blockSize = SizeClasses[sizeClass];
 
-		// Now remove from the active list.
-		RemoveFromList(allocator, &allocator->active, header);
-		// Add memory back into the free list
-		AddtoList(allocator, freeList, header);
-#if _DEBUG & MEM_TRACK_LOCATION
-		header->location = "SubRelease released this block";
+		u32 slab = 0;
+		u32 numPages = 0;
+#if MEM_THREAD_CACHE
+		ThreadCache* cache = &threadCache;
+		if (cache->allocator == allocator || cache->allocator == 0) {
+			cache->allocator = allocator;
+#if _DEBUG
+			// Cached blocks are still allocated as far as their slab knows. In debug mode only, look for the block in the cache.
+			for (u32 offset = cache->blocks[sizeClass]; offset != 0; offset = ((FreeBlock*)((u8*)allocator + offset))->nextOffset) {
+				assert((u8*)allocator + offset != (u8*)memory, "Double Free!");
+			}
 #endif
-
-		// Find the first allocation inside the page
-		u32 startPage = (u32)((u8*)header - (u8*)allocator) / allocator->pageSize;
-
-		u8* mem =(u8*)allocator + startPage * allocator->pageSize;
-
-		// Each sub allocator page contains multiple blocks. check if all of the blocks 
-		// belonging to a single page are free, if they are, release the page.
-		bool releasePage = true;
-		
-		const u32 numAllocationsPerPage = allocator->pageSize / blockSize;
-		assert(numAllocationsPerPage >= 1, __LOCATION__);
-		for (u32 i = 0; i < numAllocationsPerPage; ++i) {
-			Allocation* alloc = (Allocation*)mem;
-			if (alloc->size > 0) {
-				releasePage = false;
-				break;
+			FreeBlock* block = (FreeBlock*)memory;
+			block->nextOffset = cache->blocks[sizeClass];
+			cache->blocks[sizeClass] = (u32)((u8*)block - (u8*)allocator);
+			cache->numBlocks[sizeClass] += 1;
+
+			const u32 capacity = ThreadCacheCapacity(sizeClass);
+			if (cache->numBlocks[sizeClass] > capacity) {
+				numPages = ReturnCachedBlocks(allocator, cache, sizeClass, capacity - capacity / 2);
 			}
-			mem += blockSize;
-		}
-
-		// If appropriate, release entire page
-		if (releasePage) {
-			// Remove from free list
-			mem = (u8*)allocator + startPage * allocator->pageSize;
-			for (u32 i = 0; i < numAllocationsPerPage; ++i) {
-				Allocation* iter = (Allocation*)mem;
-				mem += blockSize;
-				assert(iter != 0, __LOCATION__);
-
-				RemoveFromList(allocator, freeList, iter);
+			if (allocator->releaseCallback != 0) {
+				slab = AllocatorPageDescriptors(allocator)[(u32)((u8*)memory - (u8*)allocator) / allocator->pageSize].runStart;
 			}
-
-			// Clear the tracking bits
-			assert(startPage > 0, __LOCATION__);
-			ClearRange(allocator, startPage, 1);
+		}
+		else
+#endif
+		{
+			// The block goes back to the arena that owns its slab, which might not be the arena of this thread
+			Arena* arena = ArenaOfPage(allocator, (u32)((u8*)memory - (u8*)allocator) / allocator->pageSize);
+			assert(AtomicLoad(&arena->sizeClasses[sizeClass].requested) >= blockSize, "Memory::Free releasing more memory than was requested");
+			AtomicAdd(&arena->sizeClasses[sizeClass].requested, 0u - blockSize);
+
+			Lock(&arena->sizeClasses[sizeClass].lock);
+			numPages = ReturnBlock(allocator, arena, sizeClass, memory, &slab);
+			Unlock(&arena->sizeClasses[sizeClass].lock);
 		}
 
 		if (allocator->releaseCallback != 0) {
-			allocator->releaseCallback(allocator, header, oldSize, blockSize, startPage, releasePage ? 1 : 0);
+			allocator->releaseCallback(allocator, memory, blockSize, blockSize, slab, numPages);
 		}
 	}
 #endif
@@ -497,25 +2053,14 @@ namespace Memory {
 	}
 
 	export int GameAllocator_wasmGetRequestedBytes(Memory::Allocator* a) {
-        return a->requested;
+        return a->Requested();
 	}
 
 	export int GameAllocator_wasmGetServedBytes(Memory::Allocator* a) {
-		u32 maskSize = AllocatorPageMaskSize(a) / (sizeof(u32) / sizeof(u8)); // convert from u8 to u32
-		u32 metaDataSizeBytes = sizeof(Memory::Allocator) + (maskSize * sizeof(u32));
-		u32 numberOfMasksUsed = metaDataSizeBytes / a->pageSize;
-		if (metaDataSizeBytes % a->pageSize != 0) {
-			numberOfMasksUsed += 1;
-		}
-		metaDataSizeBytes = numberOfMasksUsed * a->pageSize; // This way, allocatable will start on a page boundary
-		// Account for meta data
-		metaDataSizeBytes += a->pageSize;
-		numberOfMasksUsed += 1;
-
 		u32 numPages = a->size / a->pageSize;
 		u32 usedPages = a->numPagesUsed;
 		u32 freePages = numPages - usedPages;
-		u32 overheadPages = metaDataSizeBytes / a->pageSize;
+		u32 overheadPages = Memory::AllocatorOverheadPages(a);
 
 		return (usedPages - overheadPages) * a->pageSize;
 	}
@@ -523,9 +2068,9 @@ namespace Memory {
 	export int GameAllocator_wasmIsPageInUse(Memory::Allocator* a, int page) {
 		u32 m = page / Memory::TrackingUnitSize;
 		u32 b = page % Memory::TrackingUnitSize;
-		u32 * mask = (u32*)Memory::AllocatorPageMask(a);
+		Memory::TrackingUnit* mask = (Memory::TrackingUnit*)Memory::AllocatorPageMask(a);
 
-		bool set = mask[m] & (1 << b);
+		bool set = mask[m] & ((Memory::TrackingUnit)1 << b);
 		return set;
 	}
 
@@ -534,18 +2079,7 @@ namespace Memory {
 	}
 
 	export int GameAllocator_wasmGetNumOverheadPages(Memory::Allocator* a) {
-		u32 maskSize = Memory::AllocatorPageMaskSize(a) / (sizeof(u32) / sizeof(u8)); // convert from u8 to u32
-		u32 metaDataSizeBytes = Memory::AllocatorPaddedSize() + (maskSize * sizeof(u32));
-		u32 numberOfMasksUsed = metaDataSizeBytes / a->pageSize;
-		if (metaDataSizeBytes % a->pageSize != 0) {
-			numberOfMasksUsed += 1;
-		}
-		metaDataSizeBytes = numberOfMasksUsed * a->pageSize; // This way, allocatable will start on a page boundary
-		// Account for meta data
-		metaDataSizeBytes += a->pageSize;
-		numberOfMasksUsed += 1;
-
-		u32 overheadPages = metaDataSizeBytes / a->pageSize;
+		u32 overheadPages = Memory::AllocatorOverheadPages(a);
 
 		return (int)overheadPages;
 	}
@@ -585,6 +2119,41 @@ namespace Memory {
 		u8* mem = i_to_a_buff + i_to_a_buff_size;
 		u32 memSize = allocator->pageSize - i_to_a_buff_size;
 		
+		// Small allocations don't have a header, all that's known about them is their block size
+		const u32 memoryPage = (u32)((u8*)_m - (u8*)allocator) / allocator->pageSize;
+		const Memory::PageDescriptor* descriptor = &Memory::AllocatorPageDescriptors(allocator)[memoryPage];
+		if (descriptor->kind == Memory::PageKindSlab) {
+			Memory::Copy(mem, "Address: ", 9, l);
+			mem += 9; memSize -= 9;
+
+			i32 i_len = Memory::Debug::u32toa(i_to_a_buff, i_to_a_buff_size, (u32)((u8*)_m - (u8*)allocator));
+			Memory::Copy(mem, i_to_a_buff, i_len, l);
+			mem += i_len;
+			memSize -= i_len;
+
+			Memory::Copy(mem, ", block size: ", 14, l);
+			mem += 14; memSize -= 14;
+
+			i_len = Memory::Debug::u32toa(i_to_a_buff, i_to_a_buff_size, Memory::SizeClasses[descriptor->sizeClass]);
+			Memory::Copy(mem, i_to_a_buff, i_len, l);
+			mem += i_len;
+			memSize -= i_len;
+
+			Memory::Copy(mem, ", slab: ", 8, l);
+			mem += 8; memSize -= 8;
+
+			i_len = Memory::Debug::u32toa(i_to_a_buff, i_to_a_buff_size, descriptor->runStart);
+			Memory::Copy(mem, i_to_a_buff, i_len, l);
+			mem += i_len;
+			memSize -= i_len;
+
+			*mem = '\0';
+
+			allocator->ReleaseDbgPage();
+
+			return debugPage + i_to_a_buff_size;
+		}
+
 		u8* m = (u8*)_m - sizeof(Memory::Allocation);
 		Memory::Allocation* iter = (Memory::Allocation*)m;
 
@@ -636,6 +2205,7 @@ namespace Memory {
 		mem += i_len;
 		memSize -= i_len;
 
+	#if MEM_TRACK_ACTIVE
 		Memory::Copy(mem, ", prev: ", 8, l);
 		mem += 8; memSize -= 8;
 
@@ -651,11 +2221,13 @@ namespace Memory {
 		Memory::Copy(mem, i_to_a_buff, i_len, l);
 		mem += i_len;
 		memSize -= i_len;
+	#endif
 
 		u32 pathLen = 0;
 	#if MEM_TRACK_LOCATION
-		if (iter->location != 0) {
-			pathLen = GameAllocator_wasmStrLen((const char*)iter->location);
+		const char* location = Memory::AllocationLocation(allocator, iter);
+		if (location != 0) {
+			pathLen = GameAllocator_wasmStrLen(location);
 		}
 	#endif
 
@@ -663,7 +2235,7 @@ namespace Memory {
 		mem += 12; memSize -= 12;
 
 	#if MEM_TRACK_LOCATION
-		if (iter->location == 0) {
+		if (location == 0) {
 	#else
 		{
 	#endif
@@ -672,7 +2244,7 @@ namespace Memory {
 		}   
 	#if MEM_TRACK_LOCATION
 		else {
-			Memory::Copy(mem, iter->location, pathLen, l);
+			Memory::Copy(mem, location, pathLen, l);
 			mem += pathLen;
 			memSize -= pathLen;
 		}
@@ -733,7 +2305,7 @@ u32 Memory::AlignAndTrim(void** memory, u32* size, u32 alignment, u32 pageSize)
 	return delta;
 }
 
-Memory::Allocator* Memory::Initialize(void* memory, u32 bytes, u32 pageSize) {
+Memory::Allocator* Memory::Initialize(void* memory, u32 bytes, u32 pageSize, u32 numArenas) {
 	assert(pageSize % AllocatorAlignment == 0, "Memory::Initialize, Page boundaries are expected to be on 8 bytes");
 	// First, make sure that the memory being passed in is aligned well
 #if ATLAS_64
@@ -746,36 +2318,71 @@ Memory::Allocator* Memory::Initialize(void* memory, u32 bytes, u32 pageSize) {
 	assert(ptr % AllocatorAlignment == 0, "Memory::Initialize, Memory being managed should be 8 byte aligned. Consider using Memory::AlignAndTrim");
 	assert(bytes % pageSize == 0, "Memory::Initialize, the size of the memory being managed must be aligned to Memory::PageSize");
 	assert(bytes / pageSize >= 10, "Memory::Initialize, minimum memory size is 10 pages, page size is Memory::PageSize");
+#if MEM_PAGE_RUN_LISTS
+	assert(pageSize >= sizeof(FreePageRun) * 2, "Memory::Initialize, page size is too small to track free page runs");
+#endif
+	assert(pageSize / SizeClasses[0] <= 0xFFFF, "Memory::Initialize, page size is too big to count the blocks of a slab");
+	assert(numArenas <= 0xFFFF, "Memory::Initialize, the page descriptors can't tell this many arenas apart");
+	if (numArenas == 0) {
+		numArenas = 1;
+	}
+
+	// Pick the fastest way to scan the page mask on this CPU
+	SelectSkipUnitsKernel();
 
 	// Set up the allocator
 	Allocator* allocator = (Allocator*)memory;
 	Set(memory, 0, sizeof(Allocator), "Memory::Initialize");
 	allocator->size = bytes;
 	allocator->pageSize = pageSize;
+	allocator->numArenas = numArenas;
 	allocator->mask = 0;
 
 	// Set up the mask that will track our allocation data
 	u32* mask = (u32*)AllocatorPageMask(allocator);
 	u32 maskSize = AllocatorPageMaskSize(allocator) / (sizeof(u32) / sizeof(u8)); // convert from u8 to u32
 	Set(mask, 0, sizeof(u32) * maskSize, __LOCATION__);
+
+	// Every tracking unit starts out with free pages. The bits past the last tracking unit stay clear.
+	TrackingUnit* summary = (TrackingUnit*)AllocatorSummaryMask(allocator);
+	u32 numTrackingUnits = AllocatorPageMaskSize(allocator) / sizeof(TrackingUnit);
+	Set(summary, 0, AllocatorSummaryMaskSize(allocator), __LOCATION__);
+	for (u32 i = 0; i < numTrackingUnits; ++i) {
+		summary[i / TrackingUnitSize] |= ((TrackingUnit)1 << (i % TrackingUnitSize));
+	}
 	
-	// Find how many pages the meta data for the header + allocation mask will take up. 
-	// Store the offset to first allocatable, 
-	u32 metaDataSizeBytes = AllocatorPaddedSize() + (maskSize * sizeof(u32));
-	u32 numberOfMasksUsed = metaDataSizeBytes / pageSize;
-	if (metaDataSizeBytes % pageSize != 0) {
-		numberOfMasksUsed += 1;
+	// Find how many pages the meta data for the header + allocation mask + summary mask + descriptors + arenas + debug page take up. 
+	u32 numberOfMasksUsed = AllocatorOverheadPages(allocator);
+
+	// Every arena starts its page search at a different spot, so arenas that don't search from the start
+	// of memory tend to claim pages in different tracking units
+	allocator->arenas = (Arena*)AllocatorArenas(allocator);
+	Set(allocator->arenas, 0, numArenas * ArenaSize, __LOCATION__);
+	for (u32 i = 0; i < numArenas; ++i) {
+		Arena* arena = ArenaAt(allocator, i);
+		arena->index = i;
+		arena->scanBit = numberOfMasksUsed + (u32)((u64)(bytes / pageSize - numberOfMasksUsed) * i / numArenas);
 	}
-	metaDataSizeBytes = numberOfMasksUsed * pageSize; // This way, allocatable will start on a page boundary
-
-	// Add a debug page at the end
-	metaDataSizeBytes += pageSize;
-	numberOfMasksUsed += 1;
 
-	//allocator->offsetToAllocatable = metaDataSizeBytes;
-	allocator->scanBit = 0;
+	//allocator->offsetToAllocatable = numberOfMasksUsed * pageSize;
+	allocator->numPagesFree = bytes / pageSize;
+	allocator->largestFreeRun = allocator->numPagesFree;
 	SetRange(allocator, 0, numberOfMasksUsed);
-	allocator->requested = 0;
+
+	// Every page starts out free, except for the meta data
+	Set(AllocatorPageDescriptors(allocator), 0, AllocatorPageDescriptorsSize(allocator), __LOCATION__);
+	SetPageDescriptors(allocator, 0, numberOfMasksUsed, PageKindMeta, 0);
+	SetPageDescriptors(allocator, numberOfMasksUsed, bytes / pageSize - numberOfMasksUsed, PageKindFree, 0);
+
+#if MEM_PAGE_RUN_LISTS
+	// Everything after the debug page starts out as one big free run
+	Set(AllocatorPageRunIndex(allocator), 0, AllocatorPageRunIndexSize(allocator), __LOCATION__);
+	InsertFreeRun(allocator, numberOfMasksUsed, bytes / pageSize - numberOfMasksUsed);
+#elif MEM_BUDDY
+	// Everything after the debug page is split into the biggest buddy blocks that fit
+	Set(AllocatorPageRunIndex(allocator), 0, AllocatorPageRunIndexSize(allocator), __LOCATION__);
+	ReleaseBuddyBlocks(allocator, numberOfMasksUsed, bytes / pageSize - numberOfMasksUsed);
+#endif
 
 	if (ptr % AllocatorAlignment != 0 || bytes % pageSize != 0 || bytes / pageSize < 10) {
 		assert(false, __LOCATION__);
@@ -787,35 +2394,54 @@ Memory::Allocator* Memory::Initialize(void* memory, u32 bytes, u32 pageSize) {
 
 void Memory::Shutdown(Allocator* allocator) {
 	assert(allocator != 0, "Memory::Shutdown called without it being initialized");
-	u32* mask = (u32*)AllocatorPageMask(allocator);
-	u32 maskSize = AllocatorPageMaskSize(allocator) / (sizeof(u32) / sizeof(u8)); // convert from u8 to u32
 	assert(allocator->size > 0, "Memory::Shutdown, trying to shut down an un-initialized allocator");
 
-	// Unset tracking bits
-	u32 metaDataSizeBytes = AllocatorPaddedSize() + (maskSize * sizeof(u32));
-	u32 numberOfMasksUsed = metaDataSizeBytes / allocator->pageSize;
-	if (metaDataSizeBytes % allocator->pageSize != 0) {
-		numberOfMasksUsed += 1;
-	}
-	metaDataSizeBytes = numberOfMasksUsed * allocator->pageSize;
+	// The empty slabs that were kept around are not leaks
+	allocator->Trim();
 
-	// There is a debug between the memory bitmask and allocatable memory
-	metaDataSizeBytes += allocator->pageSize;
-	numberOfMasksUsed += 1;
+#if MEM_USE_SUBALLOCATORS && MEM_THREAD_CACHE
+	// Trim gave back the blocks this thread cached. The cache must not stay bound, or it would take blocks from
+	// a dead allocator, or give them back to it when the thread exits.
+	if (threadCache.allocator == allocator) {
+		threadCache.allocator = 0;
+	}
+#endif
 
+	// Unset tracking bits, this includes the debug page between the meta data and allocatable memory
+	u32 numberOfMasksUsed = AllocatorOverheadPages(allocator);
 	ClearRange(allocator, 0, numberOfMasksUsed);
-	assert(allocator->requested == 0, "Memory::Shutdown, not all memory has been released");
 
-	assert(allocator->active == 0, "There are active allocations in Memory::Shutdown, leaking memory");
-	assert(allocator->free_64 == 0, "Free list is not empty in Memory::Shutdown, leaking memory");
-	assert(allocator->free_128 == 0, "Free list is not empty in Memory::Shutdown, leaking memory");
-	assert(allocator->free_256 == 0, "Free list is not empty in Memory::Shutdown, leaking memory");
-	assert(allocator->free_512 == 0, "Free list is not empty in Memory::Shutdown, leaking memory");
-	assert(allocator->free_1024 == 0, "Free list is not empty in Memory::Shutdown, leaking memory");
-	assert(allocator->free_2048 == 0, "Free list is not empty in Memory::Shutdown, leaking memory");
+#if MEM_PAGE_RUN_LISTS
+	// If everything was released, all allocatable memory has been merged back into a single run
+	assert(FreePageRunAt(allocator, numberOfMasksUsed)->numPages == allocator->size / allocator->pageSize - numberOfMasksUsed, "Memory::Shutdown, not all pages have been released");
+#elif MEM_BUDDY && _DEBUG
+	// If everything was released, the free buddy blocks cover all allocatable memory again
+	for (u32 page = numberOfMasksUsed; page < allocator->size / allocator->pageSize;) {
+		const u8 order = BuddyOrderTable(allocator)[page];
+		assert(order != 0, "Memory::Shutdown, not all pages have been released");
+		page += 1u << (order - 1);
+	}
+#endif
+	assert(allocator->Requested() == 0, "Memory::Shutdown, not all memory has been released");
+
+#if !MEM_TRACK_ACTIVE
+	assert(FindLargeAllocation(allocator, 0) == 0, "There are active allocations in Memory::Shutdown, leaking memory");
+#endif
 
 #if _DEBUG
-	// In debug mode only, we will scan the entire mask to make sure all memory has been free-d
+	// In debug mode only, check that every arena is empty, and scan the entire mask to make sure all memory has been free-d
+	for (u32 a = 0; a < allocator->numArenas; ++a) {
+		Arena* arena = ArenaAt(allocator, a);
+#if MEM_TRACK_ACTIVE
+		assert(arena->active == 0, "There are active allocations in Memory::Shutdown, leaking memory");
+#endif
+		for (u32 i = 0; i < NumSizeClasses; ++i) {
+			assert(arena->sizeClasses[i].partialSlabs == 0, "Free list is not empty in Memory::Shutdown, leaking memory");
+		}
+	}
+
+	u32* mask = (u32*)AllocatorPageMask(allocator);
+	u32 maskSize = AllocatorPageMaskSize(allocator) / (sizeof(u32) / sizeof(u8)); // convert from u8 to u32
 	for (u32 i = 0; i < maskSize; ++i) {
 		assert(mask[i] == 0, "Page tracking unit isn't empty in Memory::Shutdown, leaking memory.");
 	}
@@ -1007,24 +2633,10 @@ u8* Memory::Allocator::RequestDbgPage() {
 	assert(allocator->mask == 0, "Debug page already in use");
 	allocator->mask  = 1;
 
-	// Set up the mask that will track our allocation data
-	u32* mask = (u32*)AllocatorPageMask(allocator);
-	u32 maskSize = AllocatorPageMaskSize(allocator) / (sizeof(u32) / sizeof(u8)); // convert from u8 to u32
-
-	// Find how many pages the meta data for the header + allocation mask will take up. 
-	// Store the offset to first allocatable, 
-	u32 metaDataSizeBytes = AllocatorPaddedSize() + (maskSize * sizeof(u32));
-	u32 numberOfMasksUsed = metaDataSizeBytes / allocator->pageSize;
-	if (metaDataSizeBytes % allocator->pageSize != 0) {
-		numberOfMasksUsed += 1;
-	}
-	metaDataSizeBytes = numberOfMasksUsed * allocator->pageSize; // This way, allocatable will start on a page boundary
-
-	// Add a debug page at the end
-	metaDataSizeBytes += allocator->pageSize;
-	numberOfMasksUsed += 1;
+	// Find how many pages the meta data + debug page take up
+	u32 numberOfMasksUsed = AllocatorOverheadPages(allocator);
 
-	u8* debugPage = (u8*)allocator + metaDataSizeBytes - allocator->pageSize; // Debug page is always one page before allocatable
+	u8* debugPage = (u8*)allocator + (numberOfMasksUsed - 1) * allocator->pageSize; // Debug page is always one page before allocatable
 	return debugPage;
 }
 
@@ -1041,7 +2653,7 @@ void* Memory::Allocator::Allocate(u32 bytes, u32 alignment, const char* location
 	}
 	Memory::Allocator* allocator = this;
 	assert(bytes < allocator->size, "Memory::Allocate trying to allocate more memory than is available");
-	assert(bytes < allocator->size - allocator->requested, "Memory::Allocate trying to allocate more memory than is available");
+	assert(bytes < allocator->size - allocator->Requested(), "Memory::Allocate trying to allocate more memory than is available");
 
 	u32 allocationHeaderPadding = 0;
 	if (alignment != 0) { // Add paddnig to make sure we can align the memory
@@ -1049,6 +2661,16 @@ void* Memory::Allocator::Allocate(u32 bytes, u32 alignment, const char* location
 	}
 	u32 allocationHeaderSize = sizeof(Allocation) + allocationHeaderPadding;
 
+#if MEM_USE_SUBALLOCATORS
+	// Small allocations don't have a header, they take up a whole block of the smallest size class that fits
+	{
+		const u32 sizeClass = FindAlignedSizeClass(allocator, bytes, alignment);
+		if (sizeClass < NumSizeClasses) {
+			return SubAllocate(bytes, sizeClass, location, allocator);
+		}
+	}
+#endif
+
 	// Add the header size to our allocation size
 	u32 allocationSize = bytes; // Add enough space to pad out for alignment
 	allocationSize += allocationHeaderSize;
@@ -1057,47 +2679,22 @@ void* Memory::Allocator::Allocate(u32 bytes, u32 alignment, const char* location
 	u32 numPagesRequested = allocationSize / allocator->pageSize + (allocationSize % allocator->pageSize ? 1 : 0);
 	assert(numPagesRequested > 0, "Memory::Allocate needs to request at least 1 page");
 	
-	// We can record the request here. It's made before the allocation callback, and is valid for sub-allocations too.
-	allocator->requested += bytes;
-	assert(allocator->requested < allocator->size, __LOCATION__);
-
-#if MEM_USE_SUBALLOCATORS
-	if (alignment == 0) {
-		if (allocationSize <= 64) {
-			return SubAllocate(bytes, 64, &allocator->free_64, location, allocator);
-		}
-		else if (allocationSize <= 128) {
-			return SubAllocate(bytes, 128, &allocator->free_128, location, allocator);
-		}
-		else if (allocationSize <= 256) {
-			return SubAllocate(bytes, 256, &allocator->free_256, location, allocator);
-		}
-		else if (allocationSize <= 512) {
-			return SubAllocate(bytes, 512, &allocator->free_512, location, allocator);
-		}
-		else if (allocationSize <= 1024) {
-			return SubAllocate(bytes, 1024, &allocator->free_1024, location, allocator);
-		}
-		else if (allocationSize <= 2048) {
-			return SubAllocate(bytes, 2048, &allocator->free_2048, location, allocator);
-		}
-	}
-#endif
-
-	// Find enough memory to allocate
-#if MEM_FIRST_FIT
-	u32 firstPage = FindRange(allocator, numPagesRequested, 0);
-#else
-	u32 firstPage = FindRange(allocator, numPagesRequested, allocator->scanBit);
-#endif
+	// Find enough memory to allocate. The page lock is held until the descriptors are filled in.
+	Arena* arena = ThreadArena(allocator);
+	LockPages(allocator);
+	u32 firstPage = AllocatePages(allocator, arena, numPagesRequested, PageKindLarge, 0);
 	assert(firstPage != 0, "Memory::Allocate failed to find enough pages to fufill allocation");
 
-	SetRange(allocator, firstPage, numPagesRequested);
-
 	if (firstPage == 0 || allocator->size % allocator->pageSize != 0) {
+		UnlockPages(allocator);
 		assert(false, __LOCATION__);
 		return 0; // Fail this allocation in release mode
 	}
+
+	// The request is only recorded once it has pages, a failed allocation doesn't count. It's made before the
+	// allocation callback.
+	AtomicAdd(&arena->requested, bytes);
+	assert(AtomicLoad(&arena->requested) < allocator->size, __LOCATION__);
 	
 	// Fill out header
 	u8* mem = (u8*)allocator + firstPage * allocator->pageSize;
@@ -1120,18 +2717,31 @@ void* Memory::Allocator::Allocate(u32 bytes, u32 alignment, const char* location
 	Allocation* allocation = (Allocation*)mem;
 	mem += sizeof(Allocation);
 
+	// Release finds the run from the page that the memory is in, which alignment can push past the first page
+	PageDescriptor* descriptors = AllocatorPageDescriptors(allocator);
+	descriptors[firstPage].header = (u32)((u8*)allocation - (u8*)allocator);
+#if MEM_TRACK_LOCATION
+	SetAllocationLocation(allocator, allocation, firstPage, location);
+#endif
+	const u32 memoryPage = (u32)(mem - (u8*)allocator) / allocator->pageSize;
+	if (memoryPage != firstPage) {
+		descriptors[memoryPage] = descriptors[firstPage];
+	}
+
+	UnlockPages(allocator);
+
 	allocation->alignment = alignment;
 	allocation->size = bytes;
+	// Track allocated memory
+#if MEM_TRACK_ACTIVE
 	allocation->prevOffset = 0;
 	allocation->nextOffset = 0;
-#if MEM_TRACK_LOCATION
-	allocation->location = location;
+	Lock(&arena->activeLock);
+	assert(allocation != arena->active, __LOCATION__); // Should be impossible, but we could have bugs...
+	AddtoList(allocator, &arena->active, allocation);
+	Unlock(&arena->activeLock);
 #endif
 
-	// Track allocated memory
-	assert(allocation != allocator->active, __LOCATION__); // Should be impossible, but we could have bugs...
-	AddtoList(allocator, &allocator->active, allocation);
-
 	// Return memory
 #if MEM_CLEAR_ON_ALLOC
 	Set(mem, 0, bytes, location);
@@ -1153,10 +2763,58 @@ void* Memory::Allocator::Allocate(u32 bytes, u32 alignment, const char* location
 	return mem;
 }
 
+bool Memory::Allocator::CanAllocate(u32 bytes, u32 alignment) {
+	if (bytes == 0) {
+		bytes = 1;
+	}
+
+	// Same size math as Allocate
+	u32 allocationSize = bytes + sizeof(Allocation);
+	if (alignment != 0) {
+		allocationSize += alignment - 1;
+	}
+	u32 numPagesRequested = allocationSize / pageSize + (allocationSize % pageSize ? 1 : 0);
+
+#if MEM_USE_SUBALLOCATORS
+	const u32 sizeClass = FindAlignedSizeClass(this, bytes, alignment);
+	if (sizeClass < NumSizeClasses) {
+#if MEM_THREAD_CACHE
+		// Allocate takes a cached block first, even when the slabs have no free blocks left
+		if (threadCache.allocator == this && threadCache.numBlocks[sizeClass] != 0) {
+			return true;
+		}
+#endif
+		if (AtomicLoad(&ThreadArena(this)->sizeClasses[sizeClass].partialSlabs) != 0) {
+			return true;
+		}
+		numPagesRequested = SlabPages(this, SizeClasses[sizeClass]);
+	}
+#endif
+#if MEM_BUDDY
+	numPagesRequested = BuddyBlockPages(numPagesRequested);
+#endif
+
+	return numPagesRequested <= LargestFreeRunBound(this);
+}
+
 void Memory::Allocator::Release(void* memory, const char* location) {
 	assert(memory != 0, "Memory:Free can't free a null pointer");
 	Allocator* allocator = this;
 
+	// The descriptor of the page that holds the memory knows what kind of memory this is, and where its run is
+	u32 memoryPage = (u32)((u8*)memory - (u8*)allocator) / allocator->pageSize;
+	assert((u8*)memory > (u8*)allocator && memoryPage < allocator->size / allocator->pageSize, "Memory::Free, memory does not belong to this allocator");
+	PageDescriptor* descriptor = &AllocatorPageDescriptors(allocator)[memoryPage];
+	assert(descriptor->kind == PageKindLarge || descriptor->kind == PageKindSlab, "Memory::Free, memory was not allocated by this allocator, or was already released");
+
+#if MEM_USE_SUBALLOCATORS
+	// Small allocations don't have a header, the slab knows how big its blocks are
+	if (descriptor->kind == PageKindSlab) {
+		SubRelease(memory, descriptor->sizeClass, location, allocator);
+		return;
+	}
+#endif
+
 	// Retrieve allocation information from header. The allocation header always
 	// preceeds the allocation.
 	u8* mem = (u8*)memory;
@@ -1174,57 +2832,115 @@ void Memory::Allocator::Release(void* memory, const char* location) {
 	u32 paddedAllocationSize = allocationSize + allocationHeaderPadding + sizeof(Allocation);
 	assert(allocationSize != 0, "Memory::Free, double free");
 	
-	assert(allocator->requested >= allocation->size, "Memory::Free releasing more memory than was requested");
-	assert(allocator->requested != 0, "Memory::Free releasing more memory, but there is nothing to release");
-	allocator->requested -= allocation->size;
+	// Large allocations are also released to the arena that made them
+	Arena* arena = ArenaAt(allocator, descriptor->arena);
+	assert(AtomicLoad(&arena->requested) >= allocation->size, "Memory::Free releasing more memory than was requested");
+	assert(AtomicLoad(&arena->requested) != 0, "Memory::Free releasing more memory, but there is nothing to release");
+	AtomicAdd(&arena->requested, 0u - allocation->size);
+
+	// Set the size to 0, to indicate that this header has been free-d. This has to happen before the pages are
+	// released, a page aligned header sits where the free page run of its first page is written. With
+	// MEM_THREAD_SAFE another thread could also allocate the pages again right after.
+	u32 oldSize = allocation->size;
+	allocation->size = 0;
 
-#if MEM_USE_SUBALLOCATORS
-	if (alignment == 0) {
-		if (paddedAllocationSize <= 64) {
-			SubRelease(memory, 64, &allocator->free_64, location, allocator);
-			return;
-		}
-		else if (paddedAllocationSize <= 128) {
-			SubRelease(memory, 128, &allocator->free_128, location, allocator);
-			return;
-		}
-		else if (paddedAllocationSize <= 256) {
-			SubRelease(memory, 256, &allocator->free_256, location, allocator);
-			return;
-		}
-		else if (paddedAllocationSize <= 512) {
-			SubRelease(memory, 512, &allocator->free_512, location, allocator);
-			return;
-		}
-		else if (paddedAllocationSize <= 1024) {
-			SubRelease(memory, 1024, &allocator->free_1024, location, allocator);
-			return;
-		}
-		else if (paddedAllocationSize <= 2048) {
-			SubRelease(memory, 2048, &allocator->free_2048, location, allocator);
-			return;
-		}
-	}
+	// Unlink tracking, the header is gone once the pages are released
+#if MEM_TRACK_ACTIVE
+	Lock(&arena->activeLock);
+	RemoveFromList(allocator, &arena->active, allocation);
+	Unlock(&arena->activeLock);
 #endif
 
 	// Clear the bits that where tracking this memory
-	u8* firstMemory = (u8*)allocator;
-	u32 address = (u32)((u8*)mem - (u8*)firstMemory);
+	u32 firstPage = descriptor->runStart;
+	u32 numPages = descriptor->runLength;
+	assert(firstPage <= memoryPage && memoryPage < firstPage + numPages, "Memory::Free, corrupt page descriptor");
+	LockPages(allocator);
+	if (memoryPage != firstPage) {
+		descriptor->kind = PageKindFree;
+	}
+	ReleasePages(allocator, firstPage, numPages);
+	UnlockPages(allocator);
+
+	if (allocator->releaseCallback != 0) {
+		allocator->releaseCallback(allocator, allocation, oldSize, paddedAllocationSize, firstPage, numPages);
+	}
+}
 
-	u32 firstPage = address / allocator->pageSize;
-	u32 numPages = paddedAllocationSize / allocator->pageSize + (paddedAllocationSize % allocator->pageSize ? 1 : 0);
-	ClearRange(allocator, firstPage, numPages);
+u32 Memory::Allocator::Requested() {
+	u32 requested = 0;
+	for (u32 i = 0; i < numArenas; ++i) {
+		Arena* arena = ArenaAt(this, i);
+		requested += AtomicLoad(&arena->requested);
+		for (u32 sizeClass = 0; sizeClass < NumSizeClasses; ++sizeClass) {
+			requested += AtomicLoad(&arena->sizeClasses[sizeClass].requested);
+		}
+	}
+	return requested;
+}
 
-	// Unlink tracking
-	RemoveFromList(allocator, &allocator->active, allocation);
+void Memory::Allocator::BindThread(u32 arena) {
+	threadArena = arena + 1;
+}
 
-	// Set the size to 0, to indicate that this header has been free-d
-	u32 oldSize = allocation->size;
-	allocation->size = 0;
+bool Memory::Allocator::Owns(void* memory) {
+	if ((u8*)memory < (u8*)this + sizeof(Allocation) || (u8*)memory >= (u8*)this + size) {
+		return false;
+	}
 
-	if (allocator->releaseCallback != 0) {
-		allocator->releaseCallback(allocator, allocation, oldSize, paddedAllocationSize, firstPage, numPages);
+	const u32 memoryPage = (u32)((u8*)memory - (u8*)this) / pageSize;
+	const PageDescriptor* descriptor = &AllocatorPageDescriptors(this)[memoryPage];
+	if (descriptor->kind == PageKindSlab) {
+		// Only the start of a block that has been handed out is an allocation
+		const u32 slab = descriptor->runStart;
+		descriptor = &AllocatorPageDescriptors(this)[slab];
+		const u32 blockOffset = (u32)((u8*)memory - (u8*)this) - slab * pageSize;
+		const u32 blockSize = SizeClasses[descriptor->sizeClass];
+		return blockOffset % blockSize == 0 && blockOffset / blockSize < descriptor->carvedBlocks;
+	}
+	return descriptor->kind == PageKindLarge;
+}
+
+void Memory::Allocator::FlushThreadCache() {
+#if MEM_USE_SUBALLOCATORS && MEM_THREAD_CACHE
+	ThreadCache* cache = &threadCache;
+	if (cache->allocator != this) {
+		return;
+	}
+	for (u32 sizeClass = 0; sizeClass < NumSizeClasses; ++sizeClass) {
+		ReturnCachedBlocks(this, cache, sizeClass, 0);
+	}
+	cache->allocator = 0;
+#endif
+}
+
+u32 Memory::Allocator::Trim() {
+	u32 numPagesReleased = 0;
+#if MEM_USE_SUBALLOCATORS
+	// Blocks cached by the calling thread keep their slabs from being empty
+	FlushThreadCache();
+
+	PageDescriptor* descriptors = AllocatorPageDescriptors(this);
+	for (u32 i = 0; i < numArenas; ++i) {
+		Arena* arena = ArenaAt(this, i);
+		for (u32 sizeClass = 0; sizeClass < NumSizeClasses; ++sizeClass) {
+			Lock(&arena->sizeClasses[sizeClass].lock);
+			u32 slab = arena->sizeClasses[sizeClass].partialSlabs;
+			while (slab != 0 && arena->sizeClasses[sizeClass].emptySlabs > 0) {
+				const u32 next = descriptors[slab].nextSlab;
+				if (descriptors[slab].liveBlocks == 0) {
+					numPagesReleased += descriptors[slab].runLength;
+					ReleaseSlab(this, arena, sizeClass, slab);
+					arena->sizeClasses[sizeClass].emptySlabs -= 1;
+				}
+				slab = next;
+			}
+			assert(arena->sizeClasses[sizeClass].emptySlabs == 0, "Memory::Trim, empty slab is not in the list of partial slabs");
+			Unlock(&arena->sizeClasses[sizeClass].lock);
+		}
 	}
+#endif
+	return numPagesReleased;
 }
 
 namespace Memory {
@@ -1383,23 +3099,12 @@ void Memory::Debug::MemInfo(Allocator* allocator, WriteCallback callback, void*
 		mem += out0.size();
 		memSize -= out0.size();
 
-		u32 maskSize = AllocatorPageMaskSize(allocator) / (sizeof(u32) / sizeof(u8)); // convert from u8 to u32
-		u32 metaDataSizeBytes = AllocatorPaddedSize() + (maskSize * sizeof(u32));
-		u32 numberOfMasksUsed = metaDataSizeBytes / allocator->pageSize;
-		if (metaDataSizeBytes % allocator->pageSize != 0) {
-			numberOfMasksUsed += 1;
-		}
-		metaDataSizeBytes = numberOfMasksUsed * allocator->pageSize; // This way, allocatable will start on a page boundary
-		// Account for meta data
-		metaDataSizeBytes += allocator->pageSize;
-		numberOfMasksUsed += 1;
-
 		u32 numPages = allocator->size / allocator->pageSize;
 		assert(allocator->size % allocator->pageSize == 0, l);
 		u32 usedPages = allocator->numPagesUsed;
 		assert(usedPages <= numPages, l);
 		u32 freePages = numPages - usedPages;
-		u32 overheadPages = metaDataSizeBytes / allocator->pageSize;
+		u32 overheadPages = AllocatorOverheadPages(allocator);
 		assert(usedPages >= overheadPages, l);
 		usedPages -= overheadPages;
 
@@ -1433,7 +3138,7 @@ void Memory::Debug::MemInfo(Allocator* allocator, WriteCallback callback, void*
 		mem += out3.size();
 		memSize -= out3.size();
 
-		i_len = u32toa(i_to_a_buff, i_to_a_buff_size, allocator->requested);
+		i_len = u32toa(i_to_a_buff, i_to_a_buff_size, allocator->Requested());
 		Copy(mem, i_to_a_buff, i_len, l);
 		mem += i_len;
 		memSize -= i_len;
@@ -1470,7 +3175,12 @@ void Memory::Debug::MemInfo(Allocator* allocator, WriteCallback callback, void*
 		mem += out0.size();
 		memSize -= out0.size();
 
-		for (Allocation* iter = allocator->active; iter != 0; iter = (iter->nextOffset == 0)? 0 : (Allocation*)((u8*)allocator + iter->nextOffset)) {
+#if MEM_TRACK_ACTIVE
+		for (u32 a = 0; a < allocator->numArenas; ++a)
+		for (Allocation* iter = ArenaAt(allocator, a)->active; iter != 0; iter = (iter->nextOffset == 0)? 0 : (Allocation*)((u8*)allocator + iter->nextOffset)) {
+#else
+		for (Allocation* iter = FindLargeAllocation(allocator, 0); iter != 0; iter = NextLargeAllocation(allocator, iter)) {
+#endif
 			//u64 address = (u64)((void*)iter);
 			u64 alloc_address = (u64)((void*)allocator);
 
@@ -1532,6 +3242,7 @@ void Memory::Debug::MemInfo(Allocator* allocator, WriteCallback callback, void*
 			mem += i_len;
 			memSize -= i_len;
 
+#if MEM_TRACK_ACTIVE
 			constexpr str_const out0(", prev: ");
 			Copy(mem, out0.begin(), out0.size(), l);
 			mem += out0.size();
@@ -1551,11 +3262,13 @@ void Memory::Debug::MemInfo(Allocator* allocator, WriteCallback callback, void*
 			Copy(mem, i_to_a_buff, i_len, l);
 			mem += i_len;
 			memSize -= i_len;
+#endif
 
 			u32 pathLen = 0;
 #if MEM_TRACK_LOCATION
-			if (iter->location != 0) {
-				pathLen = strlen((const u8*)iter->location);
+			const char* location = AllocationLocation(allocator, iter);
+			if (location != 0) {
+				pathLen = strlen((const u8*)location);
 			}
 #endif
 
@@ -1577,7 +3290,7 @@ void Memory::Debug::MemInfo(Allocator* allocator, WriteCallback callback, void*
 			memSize -= out_loc.size();
 
 #if MEM_TRACK_LOCATION
-			if (iter->location == 0) {
+			if (location == 0) {
 #else
 			{
 #endif
@@ -1591,7 +3304,7 @@ void Memory::Debug::MemInfo(Allocator* allocator, WriteCallback callback, void*
 #if MEM_TRACK_LOCATION
 			else {
 				assert(pathLen != 0, __LOCATION__);
-				Copy(mem, iter->location, pathLen, l);
+				Copy(mem, location, pathLen, l);
 				mem += pathLen;
 				memSize -= pathLen;
 			}
@@ -1616,6 +3329,96 @@ void Memory::Debug::MemInfo(Allocator* allocator, WriteCallback callback, void*
 		}
 	}
 
+#if MEM_USE_SUBALLOCATORS
+	{ // Small allocations don't have a header to put them in the active list, count them per size class instead
+		constexpr str_const out0("\nSmall allocations:\n");
+		Copy(mem, out0.begin(), out0.size(), l);
+		mem += out0.size();
+		memSize -= out0.size();
+
+		u32 numSlabs[NumSizeClasses] = { 0 }; // In pages
+		u32 numBlocks[NumSizeClasses] = { 0 };
+
+		// A used page that follows a free page, or the end of a used run, starts a run. Its descriptor is up to date.
+		const u32 numPages = allocator->size / allocator->pageSize;
+		const TrackingUnit* mask = (TrackingUnit*)AllocatorPageMask(allocator);
+		const PageDescriptor* descriptors = AllocatorPageDescriptors(allocator);
+		for (u32 page = 0; page < numPages;) {
+			if ((mask[page / TrackingUnitSize] & ((TrackingUnit)1 << (page % TrackingUnitSize))) == 0) {
+				page += 1;
+				continue;
+			}
+
+			const PageDescriptor* descriptor = &descriptors[page];
+			assert(descriptor->runStart == page && descriptor->runLength > 0, "Memory::Debug::MemInfo, corrupt page descriptor");
+			if (descriptor->kind == PageKindSlab) {
+				numSlabs[descriptor->sizeClass] += descriptor->runLength;
+				numBlocks[descriptor->sizeClass] += descriptor->liveBlocks;
+			}
+			page += descriptor->runLength;
+		}
+
+		for (u32 i = 0; i < NumSizeClasses; ++i) {
+			if (numSlabs[i] == 0) {
+				continue;
+			}
+
+			constexpr str_const out1("\t");
+			Copy(mem, out1.begin(), out1.size(), l);
+			mem += out1.size();
+			memSize -= out1.size();
+
+			u32 i_len = u32toa(i_to_a_buff, i_to_a_buff_size, SizeClasses[i]);
+			Copy(mem, i_to_a_buff, i_len, l);
+			mem += i_len;
+			memSize -= i_len;
+
+			constexpr str_const out2(" byte blocks: ");
+			Copy(mem, out2.begin(), out2.size(), l);
+			mem += out2.size();
+			memSize -= out2.size();
+
+			i_len = u32toa(i_to_a_buff, i_to_a_buff_size, numBlocks[i]);
+			Copy(mem, i_to_a_buff, i_len, l);
+			mem += i_len;
+			memSize -= i_len;
+
+			constexpr str_const out3(" used, in ");
+			Copy(mem, out3.begin(), out3.size(), l);
+			mem += out3.size();
+			memSize -= out3.size();
+
+			i_len = u32toa(i_to_a_buff, i_to_a_buff_size, numSlabs[i]);
+			Copy(mem, i_to_a_buff, i_len, l);
+			mem += i_len;
+			memSize -= i_len;
+
+			constexpr str_const out4(" pages\n");
+			Copy(mem, out4.begin(), out4.size(), l);
+			mem += out4.size();
+			memSize -= out4.size();
+
+			if (memSize < allocator->pageSize / 4) { // Drain occasiaonally
+				// Dump what's been written so far
+				mem = i_to_a_buff + i_to_a_buff_size;
+				callback(mem, (allocator->pageSize - i_to_a_buff_size) - memSize, userdata);
+
+				// Reset memory buffer
+				Set(debugPage, 0, debugSize, l);
+				i_to_a_buff = debugPage; // Used to convert numbers to strings
+				mem = i_to_a_buff + i_to_a_buff_size;
+				memSize = allocator->pageSize - i_to_a_buff_size;
+			}
+		}
+
+		if (memSize != allocator->pageSize - i_to_a_buff_size) { // Drain if needed
+			// Dump what's been written so far
+			mem = i_to_a_buff + i_to_a_buff_size;
+			callback(mem, (allocator->pageSize - i_to_a_buff_size) - memSize, userdata);
+		}
+	}
+#endif
+
 	// Reset memory buffer
 	Set(debugPage, 0, debugSize, l);
 	i_to_a_buff = debugPage; // Used to convert numbers to strings
@@ -1628,7 +3431,7 @@ void Memory::Debug::MemInfo(Allocator* allocator, WriteCallback callback, void*
 
 	{ // Draw a pretty graph
 		u32 numPages = allocator->size / allocator->pageSize;
-		u32* mask = (u32*)AllocatorPageMask(allocator);
+		TrackingUnit* mask = (TrackingUnit*)AllocatorPageMask(allocator);
 
 		constexpr str_const out5("\nPage chart:\n\t");
 		Copy(mem, out5.begin(), out5.size(), l);
@@ -1639,7 +3442,7 @@ void Memory::Debug::MemInfo(Allocator* allocator, WriteCallback callback, void*
 			u32 m = i / TrackingUnitSize;
 			u32 b = i % TrackingUnitSize;
 
-			bool set = mask[m] & (1 << b);
+			bool set = mask[m] & ((TrackingUnit)1 << b);
 			if (set) {
 				Copy(mem, isSet.begin(), isSet.size(), l);
 				mem += isSet.size();
@@ -1686,6 +3489,10 @@ void Memory::Debug::MemInfo(Allocator* allocator, WriteCallback callback, void*
 	allocator->ReleaseDbgPage();
 }
 
+u32 Memory::Debug::NumOverheadPages(Allocator* allocator) {
+	return AllocatorOverheadPages(allocator);
+}
+
 void Memory::Debug::PageContent(Allocator* allocator, u32 page, WriteCallback callback, void* userdata) {
 	u8* mem = (u8*)allocator + page * allocator->pageSize;
 	u32 chunk = allocator->pageSize / 4; // Does not need to be a multiple of 4
@@ -20,12 +20,28 @@ Usage:
 	It modifies the memory and size variables that are passed to the function. AlignAndTrim returns the number of bytes lost.
 
 	Allocate memory with the allocator objects Allocate function, and release memory with the its Release function. 
-	Allocate takes an optional alignment, which by default is 0. Only unaligned allocations utilize a fast free list allocator.
+	Allocate takes an optional alignment, which by default is 0. Small allocations utilize a fast free list allocator, if
+	they are aligned to 64 bytes or less, and the memory given to Initialize is aligned at least as much as they are.
 	Both functions also take a const char* which is optionally the location of the allocation.
 
+	The allocator keeps a count of free pages (numPagesFree), and an upper bound on the longest run of free pages
+	(largestFreeRun). Allocations that need more pages than the bound fail right away, without searching memory.
+	Call CanAllocate before allocating to find out if a request is known to fail, for example to back off from 
+	streaming in more data when memory is tight.
+
 	New and delete functions are also provided, these will invoke the constructor / destructor of the class they are
 	being invoked on. New will forward up to three arguments and takes an optional location pointer.
 
+	The fourth argument of Initialize splits the allocator into that many arenas, 1 by default. Every arena has its
+	own sub-allocator lists, locks, active list, requested count and page search cursor, only the pages are shared.
+	The first time a thread allocates it's bound to the next arena, round robin. Call BindThread to pick an arena
+	for the calling thread instead. Threads in different arenas don't write to the same cache lines when they make
+	small allocations. Memory is always released to the arena that allocated it.
+
+	For types that are made and destroyed a lot, Memory::Pool<T> keeps objects of one type in chunks of pages that
+	it allocates from an allocator. Objects in a pool don't have a header, New and Delete only pop and push a free
+	list, and ForEach visits every live object in a pool.
+
 	When you are finished with an allocator, clean it up by calling Memory::Shutdown. The shutdown function 
 	will assert in debug builds if there are any memory leaks.
 
@@ -51,6 +67,12 @@ Example:
 		SomeClass* obj = allocator->New<SomeClass>("arguments");
 		allocator->Delete(obj);
 
+		// Objects of one type can come from a pool:
+		Memory::Pool<SomeClass> pool(allocator);
+		SomeClass* pooled = pool.New("arguments");
+		pool.ForEach([](SomeClass* o) { o->Update(); });
+		pool.Delete(pooled);
+
 		// Cleanup the global allocator
 		Memory::Shutdown(Memory::GlobalAllocator);
 		Memory::GlobalAllocator = 0;
@@ -65,15 +87,82 @@ Compile flags:
 	                         searches for the first available page from the start of the memory. If it's not
 					         set, then an allocation header is maintained. It's advanced with each allocation,
 					         and new allocations search for memory from the allocation header.
+	MEM_TLSF              -> If set, free runs of pages are tracked in two-level segregated free lists. Finding pages
+	                         for an allocation and returning them on release takes constant time, no matter how big
+	                         the heap is. Released pages are merged with their free neighbours right away. The page
+	                         mask is still kept up to date, it's used to find free neighbours and for debugging.
+	                         Only the first few runs of the list a request maps to are checked, so a request can
+	                         fail while a run that fits is further down that list. MEM_FIRST_FIT has no effect if
+	                         this is set.
+	MEM_BEST_FIT          -> If set, free runs of pages are tracked in the same lists as MEM_TLSF, but an allocation
+	                         is placed in the smallest free run that can hold it. Runs in the list the request maps
+	                         to are compared one by one, so this is a little slower than MEM_TLSF, but large runs are
+	                         left alone and the heap fragments less. Can't be combined with MEM_TLSF. MEM_FIRST_FIT
+	                         has no effect if this is set.
+	MEM_BUDDY             -> If set, pages are managed as power of two buddy blocks. Free blocks are kept in one list
+	                         per block size, and a released block is merged with its buddy in O(log n) steps without
+	                         scanning the page mask. Requests are rounded up to a power of two pages, and the pages
+	                         past the end of a request stay reserved until it's released. Can't be combined with
+	                         MEM_TLSF or MEM_BEST_FIT. MEM_FIRST_FIT has no effect if this is set.
 	MEM_CLEAR_ON_ALLOC    -> When set, memory will be cleared to 0 before being returned from Memory::Allocate
 	                         If both clear and debug on alloc are set, clear will take precedence
 	MEM_DEBUG_ON_ALLOC    -> If set, full page allocations will fill the padding of the page with "-MEMORY"
-	MEM_USE_SUBALLOCATORS -> If set, small allocations will be made using a free list allocaotr. There are free list
-	                         allocators for 64, 128, 256, 512, 1024 and 2049 byte allocations. Only allocations that
-							 don't specify an alignment can use the fast free list allocator. The sub-allocator will
-							 provide better page utilization, for example a 4096 KiB page can hold 32 128 bit allocations.
+	MEM_USE_SUBALLOCATORS -> If set, small allocations will be made using a free list allocaotr. There is a free list
+	                         allocator for every block size in MEM_SIZE_CLASSES. Allocations aligned to 64 bytes or less
+							 can use the fast free list allocator, they get the smallest block size that is a multiple
+							 of their alignment. This needs the memory given to Memory::Initialize to be aligned at
+							 least as much as the allocation. The sub-allocator will provide better page
+							 utilization, for example a 4096 KiB page can hold 256 128 bit allocations. Small allocations
+							 don't have an allocation header, and they are not in the active allocation list.
+	MEM_SIZE_CLASSES      -> The block sizes of the sub-allocators, in bytes. Blocks don't have a header, so this is
+	                         the largest allocation each block can hold. By default there are 38 sizes, 8 bytes apart
+	                         up to 32, 16 bytes apart up to 128, then 25% apart up to 16384. Blocks that don't divide
+	                         a page well are carved from spans of a few pages, which waste no more than an eighth.
+	MEM_KEEP_EMPTY_SLABS  -> How many empty pages each sub-allocator keeps instead of releasing them. Allocations that
+	                         keep releasing and allocating the last block of a page then never touch the page mask.
+	                         The kept pages count as used, Allocator::Trim releases them. 0 releases pages right away.
 	MEM_TRACK_LOCATION    -> If set, a const char* will be added to Memory::Allocation which tracks the __LINE__ and __FILE__
 	                         of each allocation. Setting this bit will add 8 bytes to the Memory::Allocation struct.
+	MEM_TRACK_ACTIVE      -> If set, every allocation that has a header is linked into the active list of the allocator.
+	                         Keeping the list up to date writes two more headers on every allocate and release, and adds
+	                         8 bytes to the Memory::Allocation struct. If it's not set, MemInfo finds allocations through
+	                         the page descriptors instead. By default it's only set in debug builds, unless
+	                         MEM_COMPACT_HEADER is set.
+	MEM_COMPACT_HEADER    -> If set, the Memory::Allocation struct is 8 bytes, it only holds the size and alignment. With
+	                         MEM_TRACK_LOCATION the location is kept in the page descriptor of the first page of the
+	                         allocation instead of the header. Can't be combined with MEM_TRACK_ACTIVE.
+	MEM_TRACKING_UNIT_64  -> If set, the page mask is stored as an array of u64's instead of u32's. The page search
+	                         reads the mask one tracking unit at a time, so wider units skip used memory faster.
+	MEM_USE_SIMD          -> If set, x86 / x64 builds skip long stretches of fully used or fully free pages 128 bits
+	                         at a time with SSE2, or 256 bits at a time with AVX2 if the CPU supports it. The AVX2
+	                         check happens at runtime in Memory::Initialize. Other platforms use a scalar loop.
+	MEM_THREAD_SAFE       -> If set, an allocator can be used from several threads at once. Every size class has its
+	                         own lock in every arena, and one more lock guards the pages. Small allocations of
+	                         different sizes never wait on each other, and only wait on the page lock when a slab is
+	                         made or released. The lock, slab list and requested count of a size class are on a cache
+	                         line of their own, if the memory given to Memory::Initialize is aligned to 64 bytes. The
+	                         locks are spin locks, the library doesn't call into the operating system. The functions
+	                         in Memory::Debug, Memory::Initialize and Memory::Shutdown are not thread safe.
+	MEM_THREAD_YIELD()    -> Called by a thread that has waited on a lock for a while. It does nothing by default, set it
+	                         to something like SwitchToThread() or sched_yield() if there can be more threads than cores.
+	MEM_LOCK_FREE_PAGES   -> If set together with MEM_THREAD_SAFE, pages are claimed with an atomic compare and swap on
+	                         each tracking unit of the page mask that a run touches, and released with an atomic and.
+	                         If another thread claimed one of the pages first, the claim is undone and the search starts
+	                         over. A search that finds nothing also starts over if pages were given back while it ran,
+	                         and there are still enough free pages. Threads that need pages never wait on each other,
+	                         the page lock isn't used. The page search reads the mask with atomic loads, so MEM_USE_SIMD
+	                         has no effect. largestFreeRun isn't tracked, numPagesFree is the only bound. Can't be
+	                         combined with MEM_TLSF, MEM_BEST_FIT or MEM_BUDDY. Use MEM_TRACKING_UNIT_64 to claim 64
+	                         pages per compare and swap.
+	MEM_THREAD_CACHE      -> If set, every thread keeps up to MEM_THREAD_CACHE_BLOCKS blocks of each size class for one
+	                         allocator. Small allocations and releases that hit the cache don't take a lock. An empty
+	                         cache takes half of its capacity from the sub-allocators at once, a full cache gives half
+	                         back. Cached blocks count as requested. The cache of a thread is flushed when the thread
+	                         exits, the allocator has to outlive it, or the thread has to call
+	                         Allocator::FlushThreadCache first. Allocator::Trim and Memory::Shutdown flush the cache of
+	                         the thread that calls them.
+	MEM_THREAD_CACHE_BLOCKS -> The most blocks of one size class a thread cache holds, 32 by default. Caches hold fewer
+	                         blocks of the bigger size classes, no more than 64 KiB per size class.
 
 Debugging:
 
@@ -84,8 +173,8 @@ Debugging:
 	using it by calling ReleaseDbgPage();
 
 	The Memory::Debug::MemInfo function can be used to retrieve information about the state of the memory allocator.
-	It provides meta data like how many pages are in use, a list of active allocations, and a visual bitmap chart to
-	make debugging the memory bitmask easy. You can write this information to a file like so:
+	It provides meta data like how many pages are in use, a list of active allocations, how many small allocations
+	each size class holds, and a visual bitmap chart to make debugging the memory bitmask easy. You can write this information to a file like so:
 
 	DeleteFile(L"MemInfo.txt");
 	HANDLE hFile = CreateFile(L"MemInfo.txt", GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
@@ -136,6 +225,25 @@ Resources:
 // searching from there.
 #define MEM_FIRST_FIT 1
 
+// If set to 1, free page runs are kept in two-level segregated free lists (TLSF) instead of being searched for
+// in the page mask. Allocating and releasing pages takes constant time, and released pages are merged with the
+// free pages around them right away. MEM_FIRST_FIT is ignored if this is set.
+#define MEM_TLSF 0
+
+// If set to 1, free page runs are kept in the same size bucketed lists as MEM_TLSF, but every allocation takes the
+// smallest free run that fits. This keeps large runs intact for large allocations, at the cost of walking the list
+// the request maps to. Can't be combined with MEM_TLSF. MEM_FIRST_FIT is ignored if this is set.
+#define MEM_BEST_FIT 0
+
+// If set to 1, pages are handed out as power of two sized buddy blocks. A block of 2^n pages always starts on a page
+// index that is a multiple of 2^n, so the block it merges with on release can be found without searching. Requests
+// are rounded up to a power of two pages, the pages past the end of a request stay reserved until it's released.
+#define MEM_BUDDY 0
+
+#if (MEM_TLSF + MEM_BEST_FIT + MEM_BUDDY) > 1
+	#error Only one of MEM_TLSF, MEM_BEST_FIT and MEM_BUDDY can be set
+#endif
+
 // If set to 1, the allocator will clear or fill memory when allocating it
 #define MEM_CLEAR_ON_ALLOC 0 // Clears memory on each allocation
 #define MEM_DEBUG_ON_ALLOC 0 // Fills memory with Memory- on each allocation
@@ -143,9 +251,79 @@ Resources:
 // Disables sub-allocators if defined
 #define MEM_USE_SUBALLOCATORS 1
 
+// Block sizes of the sub-allocators in bytes, one free list is kept for each. Blocks don't have an allocation header,
+// the page they are in knows their size, so the largest allocation a block can hold is its size. Blocks can be
+// bigger than a page, the sub-allocator carves them from spans of several pages.
+// Sizes must be ascending multiples of 8. The default steps by 8 bytes up to 32, by 16 bytes up to 128, then by a
+// quarter of the last power of two up to 16384.
+#define MEM_SIZE_CLASSES 8, 16, 24, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512, 640, 768, 896, 1024, 1280, 1536, 1792, 2048, \
+                         2560, 3072, 3584, 4096, 5120, 6144, 7168, 8192, 10240, 12288, 14336, 16384
+
+// How many empty slabs each size class keeps around instead of releasing their page right away
+#define MEM_KEEP_EMPTY_SLABS 1
+
 // If true, adds char* to each allocation
 #define MEM_TRACK_LOCATION 1
 
+// If true, the allocation header is 8 bytes, even with MEM_TRACK_LOCATION. The location of an allocation is kept in
+// the descriptor of its first page instead. Can't be combined with MEM_TRACK_ACTIVE, which needs room for two links.
+#define MEM_COMPACT_HEADER 0
+
+// If true, every allocation that has a header is linked into the active list of its allocator. The list costs
+// two header writes on every allocate and release, and 8 bytes in each header. Without it, MemInfo finds the
+// allocations by walking the page descriptors instead. By default the list is only kept in debug builds,
+// unless MEM_COMPACT_HEADER is set.
+#if defined(_DEBUG) && !MEM_COMPACT_HEADER
+	#define MEM_TRACK_ACTIVE 1
+#else
+	#define MEM_TRACK_ACTIVE 0
+#endif
+
+#if MEM_COMPACT_HEADER && MEM_TRACK_ACTIVE
+	#error MEM_COMPACT_HEADER can't be combined with MEM_TRACK_ACTIVE
+#endif
+
+// If set, the page mask is tracked in 64 bit units instead of 32 bit units. Wider units let the
+// page search skip twice as many used pages per read. Both sizes work on 32 and 64 bit platforms.
+#define MEM_TRACKING_UNIT_64 0
+
+// If set, long stretches of the page mask are scanned with SSE2 (or AVX2 if the CPU supports it) on x86 / x64.
+// Other platforms, like web assembly, always use the scalar scanner.
+#define MEM_USE_SIMD 1
+
+// If set, an allocator can be used from several threads at once. Every size class has its own lock, and the pages are
+// guarded by one more lock, so small allocations of different sizes never wait on each other. The lock and the slab
+// list of a size class fill a cache line of their own. The locks are spin locks, the library doesn't call into the
+// operating system.
+#define MEM_THREAD_SAFE 0
+
+// With MEM_THREAD_SAFE, a thread that has been waiting on a lock for a while calls this between checks. By default it
+// does nothing. If there can be more threads than cores, set it to something that lets the thread holding the lock
+// run, like SwitchToThread() on Windows or sched_yield() on Linux.
+#define MEM_THREAD_YIELD()
+
+// If set together with MEM_THREAD_SAFE, pages are claimed and released with atomic compare and swap on the tracking
+// units of the page mask, instead of under the page lock. Threads that need pages never wait on each other. Only
+// the page mask search can do this, so it can't be combined with MEM_TLSF, MEM_BEST_FIT or MEM_BUDDY.
+#define MEM_LOCK_FREE_PAGES 0
+
+#if MEM_LOCK_FREE_PAGES && !MEM_THREAD_SAFE
+	#error MEM_LOCK_FREE_PAGES needs MEM_THREAD_SAFE
+#endif
+
+#if MEM_LOCK_FREE_PAGES && (MEM_TLSF || MEM_BEST_FIT || MEM_BUDDY)
+	#error MEM_LOCK_FREE_PAGES can't be combined with MEM_TLSF, MEM_BEST_FIT or MEM_BUDDY
+#endif
+
+// If set, every thread keeps a few blocks of each size class in a thread local cache. Most small allocations and
+// releases then only touch the cache, without taking a lock. The cache is refilled from, and given back to, the
+// sub-allocators half a cache at a time. A thread gives its cached blocks back when it exits.
+#define MEM_THREAD_CACHE 0
+
+// The most blocks of one size class that a thread cache holds. Size classes with big blocks hold fewer,
+// a thread never caches more than 64 KiB of one size class.
+#define MEM_THREAD_CACHE_BLOCKS 32
+
 #ifndef ATLAS_U8
 	#define ATLAS_U8
 	typedef unsigned char u8;
@@ -222,65 +400,136 @@ inline void* operator new (Memory::ptr_type n, void* ptr) {
 
 namespace Memory {
 	// The callback allocator can be used to register a callback with each allocator. It's the same callback signature for both Allocate and Release
+	// Small allocations don't have a header, their callbacks get the address of the block, and are released with bytesRequested set to the block size.
 	typedef void (*Callback)(struct Allocator* allocator, void* allocationHeaderAddress, u32 bytesRequested, u32 bytesServed, u32 firstPage, u32 numPages);
 
 	// Allocation struct uses a 32 bit offset instead of a pointer. This makes the maximum amount of memory GameAllocator can manage be 4 GiB
 	typedef u32 Offset32;
 
+	// The sub-allocator block sizes from MEM_SIZE_CLASSES, smallest first
+	constexpr u32 SizeClasses[] = { MEM_SIZE_CLASSES };
+	constexpr u32 NumSizeClasses = sizeof(SizeClasses) / sizeof(SizeClasses[0]);
+
+	// The header in front of every allocation that isn't served by a sub-allocator
 	struct Allocation {
-#if MEM_TRACK_LOCATION
+#if MEM_TRACK_LOCATION && !MEM_COMPACT_HEADER
 		const char* location;
 	#if ATLAS_32
 		u32 padding_32bit; // Keep sizeof(Allocation) consistent between x64 & x86
 	#endif
 #endif
+#if MEM_TRACK_ACTIVE
 		Offset32 prevOffset; // Offsets are the number of bytes from allocator
 		Offset32 nextOffset;
+#endif
 		u32 size; // Unpadded allocation size, ie what you pass to malloc
 		u32 alignment;
 	};
 
+	// The sub-allocator state of one size class in an arena. With MEM_THREAD_SAFE it's padded out to a cache line,
+	// so threads that use different size classes never write to the same line.
+	struct SizeClassState {
+		u32 partialSlabs;			// First page of the list of sub-allocator pages (slabs) that have free blocks, 0 if there are none
+		u32 emptySlabs;				// How many of the partial slabs are empty
+		u32 requested;				// Block size times the blocks of this size class that are allocated or in thread caches
+		u32 lock;					// Only used with MEM_THREAD_SAFE, guards the partial slabs
+
+#if MEM_THREAD_SAFE
+		u8 padding[64 - 16];		// Fills the rest of the cache line
+#endif
+	};
+
+	// The state of an allocator that threads write to when they allocate and release memory. Memory::Initialize
+	// makes numArenas of these after the page descriptors. Each one starts on its own cache line, so threads
+	// that use different arenas don't take cache lines away from each other. The slab lists exist even if
+	// MEM_USE_SUBALLOCATORS is off, to keep the size of this struct consistent for debugging.
+	struct Arena {
+		// Allocations aligned to 64 bytes or less can utilize the sub allocators. The size classes come first, so with
+		// MEM_THREAD_SAFE each one starts on a cache line.
+		SizeClassState sizeClasses[NumSizeClasses];
+
+		Allocation* active;			// Memory that has been allocated, but not released. Small allocations are not in this list, it's always 0 without MEM_TRACK_ACTIVE
+
+		u32 requested;				// How many bytes where requested (raw) by allocations that have a header. Blocks are counted by their size class
+		u32 scanBit;				// Only used if MEM_FIRST_FIT is off. Arenas start searching at different pages
+		u32 activeLock;				// Only used with MEM_THREAD_SAFE, guards the active list
+		u32 index;					// Where this arena is in the array of arenas
+
+#if ATLAS_32
+		u32 padding_32bit;			// Padding to make sure the struct stays the same size in x64 / x86 builds
+#endif
+	};
+
 	// Unlike Allocation, Allocator uses pointers. There is only ever one allocator
-	// and saving a few bytes here isn't that important. Similarly, the free list
-	// pointers exist even if MEM_USE_SUBALLOCATORS is off. This is done to keep the
-	// size of this struct consistent for debugging.
+	// and saving a few bytes here isn't that important. The fields of the allocator
+	// are only written when pages are claimed or released, everything else is in
+	// the arenas.
 	struct Allocator {
 		Callback allocateCallback;	// Callback for malloc / new
 		Callback releaseCallback;	// Callback for free / delete
 
-		Allocation* free_64;		// The max size for each of these lists is whatever the number after the
-		Allocation* free_128;       // underscore is, minus the size of the Allocation structure, which is 
-		Allocation* free_256;       // either 16 or 24 bytes (depenging if the location is tracked or not).
-		Allocation* free_512;       // For exampe, the largest allocation the 64 byte free list can hold is 50 bytes
-		Allocation* free_1024;      // There isn't much significance to these numbers, tune them to better match your structs
-		Allocation* free_2048;		// Only unaligned allocations (alignment of 0) can utilize the sub allocators.
-
-		Allocation* active;			// Memory that has been allocated, but not released
+		Arena* arenas;				// numArenas arenas, each one is ArenaSize bytes from the previous one
 
 		u32 size;					// In bytes, how much total memory is the allocator managing
-		u32 requested;				// How many bytes where requested (raw)
+		u32 numArenas;
 		u32 pageSize;				// Default is 4096, but each allocator can have a unique size
-		u32 scanBit;				// Only used if MEM_FIRST_FIT is off
+		u32 nextArena;				// Threads that haven't been bound to an arena take this one, round robin
 
 		u32 numPagesUsed;
 		u32 peekPagesUsed;			// Use this to monitor how much memory your application actually needs
+		u32 numPagesFree;			// Always the number of pages in memory minus numPagesUsed
+		u32 largestFreeRun;			// Upper bound on how many pages a single allocation can get, requests above it fail right away. Not tracked with MEM_LOCK_FREE_PAGES
 		u32 mask;
 		u32 mask_padding;
 
+		// Only used with MEM_THREAD_SAFE. The page lock guards the page mask, the page run index and the page
+		// descriptors, unless MEM_LOCK_FREE_PAGES is set. The lock of a size class in an arena is taken before
+		// the page lock, the active lock of an arena after it.
+		u32 pageLock;
+		u32 pagesReturned;			// Only used with MEM_LOCK_FREE_PAGES, counts how many times pages went back to the mask
+
 #if ATLAS_32
-		u32 padding_32bit[9];		// Padding to make sure the struct stays the same size in x64 / x86 builds
+		u32 padding_32bit[3];		// Padding to make sure the struct stays the same size in x64 / x86 builds
 #endif
 
 		void* Allocate(u32 bytes, u32 alignemnt = 0, const char* location = 0);
 		void Release(void* t, const char* location = 0);
 
+		// Returns false if Allocate is known to fail for this request. Returning true does not guarantee that the 
+		// allocation will succeed, largestFreeRun is only an upper bound. It's tightened every time a page search fails.
+		// With MEM_THREAD_CACHE a block cached by the calling thread counts, even if its slabs are full.
+		bool CanAllocate(u32 bytes, u32 alignment = 0);
+
+		// How many bytes were requested from all arenas, and not released yet. With MEM_THREAD_SAFE the arenas are
+		// added up while other threads change them, so the sum is only exact if no thread is allocating.
+		u32 Requested();
+
+		// Binds the calling thread to an arena, every allocation the thread makes after this comes from it. The
+		// binding is kept per thread, not per allocator. Allocators with fewer arenas use arena % numArenas.
+		void BindThread(u32 arena);
+
+		// Returns true if memory is a live allocation made by this allocator. Only pointers returned by Allocate, 
+		// or pointers outside of this allocators memory, give a reliable answer. With MEM_THREAD_SAFE the answer can be out of
+		// date by the time it's returned, if other threads are allocating or releasing the same memory.
+		bool Owns(void* memory);
+
+		// Releases the pages of the empty slabs that the sub-allocators kept around, see MEM_KEEP_EMPTY_SLABS.
+		// The blocks cached by the calling thread are given back first.
+		// Returns how many pages were released.
+		u32 Trim();
+
+		// Gives the blocks that the calling thread has cached back to the sub-allocators, see MEM_THREAD_CACHE.
+		// Threads flush their cache when they exit, call this first if the allocator is shut down before the thread
+		// exits. Does nothing if the thread has no blocks of this allocator cached.
+		void FlushThreadCache();
+
 		u8* RequestDbgPage();
 		void ReleaseDbgPage();
 
 		template<class T, typename A1>
 		inline T* New(A1&& a1, const char* location = 0) {
 			const u32 bytes = sizeof(T);
-			const u32 alignment = 0;
+			const u32 alignment = alignof(T) > 8 ? (u32)alignof(T) : 0; // Memory is always 8 byte aligned
 			void* memory = this->Allocate(bytes, alignment, location);
 			T* object = ::new (memory) T(a1);
 			return object;
@@ -289,7 +538,7 @@ namespace Memory {
 		template<class T, typename A1, typename A2>
 		inline T* New(A1&& a1, A2&& a2, const char* location = 0) {
 			const u32 bytes = sizeof(T);
-			const u32 alignment = 0;
+			const u32 alignment = alignof(T) > 8 ? (u32)alignof(T) : 0; // Memory is always 8 byte aligned
 			void* memory = this->Allocate(bytes, alignment, location);
 			T* object = ::new (memory) T(a1, a2);
 			return object;
@@ -298,7 +547,7 @@ namespace Memory {
 		template<class T, typename A1, typename A2, typename A3>
 		inline T* New(A1&& a1, A2&& a2, A3&& a3, const char* location = 0) {
 			const u32 bytes = sizeof(T);
-			const u32 alignment = 0;
+			const u32 alignment = alignof(T) > 8 ? (u32)alignof(T) : 0; // Memory is always 8 byte aligned
 			void* memory = this->Allocate(bytes, alignment, location);
 			T* object = ::new (memory) T(a1, a2, a3);
 			return object;
@@ -307,7 +556,7 @@ namespace Memory {
 		template<class T>
 		inline T* New(const char* location = 0) {
 			const u32 bytes = sizeof(T);
-			const u32 alignment = 0;
+			const u32 alignment = alignof(T) > 8 ? (u32)alignof(T) : 0; // Memory is always 8 byte aligned
 			void* memory = this->Allocate(bytes, alignment, location);
 			T* object = ::new (memory) T();
 			return object;
@@ -326,25 +575,33 @@ namespace Memory {
 	// appropriate if needed.
 	const u32 DefaultPageSize = 4096;
 
-	// Don't change tracking unit size. The bitmask that tracks which pages are free is stored as an
-	// array of 32 bit integers. Changing this number would require changing how mem.cpp is implemented
-	const u32 TrackingUnitSize = 32;
+	// The bitmask that tracks which pages are free is stored as an array of tracking units. Each unit
+	// tracks TrackingUnitSize pages. Use MEM_TRACKING_UNIT_64 to switch between 32 and 64 bit units.
+#if MEM_TRACKING_UNIT_64
+	typedef u64 TrackingUnit;
+#else
+	typedef u32 TrackingUnit;
+#endif
+	const u32 TrackingUnitSize = sizeof(TrackingUnit) * 8;
 	// Don't change allocator alignment. Every allocator should start at an 8 byte aligned memory address.
 	// Internally the allocator uses offsets to access some data, the start alignment is important.
 	const u32 AllocatorAlignment = 8; // Should stay 8, even on 32 bit platforms
 
 	// Call AlignAndTrim before Initialize to make sure that memory is aligned to alignment
 	// and to make sure that the size of the memory (after it's been aligned) is a multiple of pageSize
-	// both arguments are modified, the return value is how many bytes where removed
+	// both arguments are modified, the return value is how many bytes where removed. Aligning the memory
+	// to 64 bytes lets small allocations that are aligned to 16, 32 or 64 bytes use the sub-allocators.
 	u32 AlignAndTrim(void** memory, u32* size, u32 alignment = AllocatorAlignment, u32 pageSize = DefaultPageSize);
 
 	// The initialize function will place the Allocator struct at the start of the provided memory. 
 	// The allocaotr struct is followed by a bitmask, in which each bit tracks if a page is in use or not.
-	// The bitmask is a bit u32 array. If the end of the bitmask is in the middle of a page, the rest of that
-	// page is lost as padding. The next page is a debug page that you can use for anything, only functions in
-	// the Memory::Debug namespace mess with the debug page, anything in Memory:: doesn't touch it.
+	// The bitmask is an array of tracking units. It's followed by a much smaller summary mask, which has one bit for
+	// every tracking unit that has free pages in it. If the end of the summary mask is in the middle of a page, the rest
+	// of that page is lost as padding. The next page is a debug page that you can use for anything, only functions in
+	// the Memory::Debug namespace mess with the debug page, anything in Memory:: doesn't touch it. The arenas are
+	// placed between the page descriptors and the debug page, numArenas of 0 is the same as 1.
 	// The allocator that's returned should be used to set the global allocator.
-	Allocator* Initialize(void* memory, u32 bytes, u32 pageSize = DefaultPageSize);
+	Allocator* Initialize(void* memory, u32 bytes, u32 pageSize = DefaultPageSize, u32 numArenas = 1);
 
 	// After you are finished with an allocator, shut it down. The shutdown function will assert in a debug build
 	// if you have any memory that was allocated but not released. This function doesn't do much, it exists
@@ -366,7 +623,260 @@ namespace Memory {
 
 		void MemInfo(Allocator* allocator, WriteCallback callback, void* userdata = 0);
 		void PageContent(Allocator* allocator, u32 page, WriteCallback callback, void* userdata = 0);
+
+		// Number of pages at the start of the managed memory that are used by the allocator itself. This is
+		// the allocator header, the page mask, the summary mask, and the debug page. 
+		u32 NumOverheadPages(Allocator* allocator);
 	}
+
+	// A pool of objects of one type, on top of an allocator. The pool allocates chunks of whole pages, and keeps the
+	// free objects of every chunk in one free list. Objects don't have a header, New pops an object off of the free
+	// list and Delete pushes it back. The last few bytes of each page in a chunk have one bit for every object in that
+	// page, the bit is set while the object is alive. ForEach uses these bits to visit live objects, which are packed
+	// next to each other. Chunks are only given back to the allocator by Clear, or when the pool is destroyed.
+	// T has to fit in a page, New returns 0 if the allocator is out of memory.
+	template<class T>
+	class Pool {
+	protected:
+		struct Chunk {
+			Chunk* next;
+			u32 size;	// In bytes, including this header
+		};
+
+		struct FreeSlot {
+			FreeSlot* next;
+		};
+
+		static constexpr u32 SlotAlignment = alignof(T) > alignof(FreeSlot) ? (u32)alignof(T) : (u32)alignof(FreeSlot);
+		static constexpr u32 SlotSize = ((sizeof(T) > sizeof(FreeSlot) ? (u32)sizeof(T) : (u32)sizeof(FreeSlot)) + SlotAlignment - 1) / SlotAlignment * SlotAlignment;
+
+		Allocator* allocator;
+		Chunk* chunks;
+		FreeSlot* freeSlots;
+		u32 chunkSize;	// In bytes, what each chunk asks the allocator for
+		u32 maskSize;	// In bytes, the live mask at the end of each page
+		u32 numLive;
+		u32 numSlots;
+
+		inline u8* PageOf(const void* memory) const {
+			const u8* base = (const u8*)allocator;
+			return (u8*)base + (u32)((const u8*)memory - base) / allocator->pageSize * allocator->pageSize;
+		}
+
+		inline u32* MaskOf(u8* page) const {
+			return (u32*)(page + allocator->pageSize - maskSize);
+		}
+
+		inline u32 SlotIndex(const void* slot, const u8* page) const {
+			return (u32)((const u8*)slot - page) / SlotSize;
+		}
+
+		// The first slot of a page in a chunk. Slots of the first page start after the chunk header.
+		inline u8* FirstSlot(Chunk* chunk, u8* page) const {
+			u8* start = page < (u8*)(chunk + 1) ? (u8*)(chunk + 1) : page;
+			return (u8*)(((ptr_type)start + SlotAlignment - 1) & ~(ptr_type)(SlotAlignment - 1));
+		}
+
+		// Every page that ends inside of the chunk holds objects. The first page might start before the chunk,
+		// because the chunk starts after its allocation header.
+		inline u8* FirstPage(Chunk* chunk) const {
+			u8* page = PageOf(chunk);
+			if (page + allocator->pageSize - maskSize < (u8*)(chunk + 1)) {
+				page += allocator->pageSize;
+			}
+			return page;
+		}
+
+		inline bool HasPage(Chunk* chunk, u8* page) const {
+			return page + allocator->pageSize <= (u8*)chunk + chunk->size;
+		}
+
+		bool AddChunk(const char* location) {
+			Chunk* chunk = (Chunk*)allocator->Allocate(chunkSize, 0, location);
+			if (chunk == 0) {
+				return false;
+			}
+			chunk->next = chunks;
+			chunk->size = chunkSize;
+			chunks = chunk;
+
+			// Push the slots in reverse, so they are handed out in address order
+			FreeSlot* head = freeSlots;
+			u8* firstPage = FirstPage(chunk);
+			u32 numPages = 0;
+			while (HasPage(chunk, firstPage + numPages * allocator->pageSize)) {
+				numPages += 1;
+			}
+			for (u32 p = numPages; p > 0; --p) {
+				u8* page = firstPage + (p - 1) * allocator->pageSize;
+				u32* mask = MaskOf(page);
+				for (u32 i = 0; i < maskSize / sizeof(u32); ++i) {
+					mask[i] = 0;
+				}
+
+				u8* first = FirstSlot(chunk, page);
+				u32 count = first + SlotSize <= (u8*)mask ? (u32)((u8*)mask - first) / SlotSize : 0;
+				for (u32 i = count; i > 0; --i) {
+					FreeSlot* slot = (FreeSlot*)(first + (i - 1) * SlotSize);
+					slot->next = head;
+					head = slot;
+				}
+				numSlots += count;
+			}
+
+			if (head == freeSlots) { // T doesn't fit in a page
+				chunks = chunk->next;
+				allocator->Release(chunk, location);
+				return false;
+			}
+			freeSlots = head;
+			return true;
+		}
+
+		inline void* Claim(const char* location) {
+			if (freeSlots == 0 && !AddChunk(location)) {
+				return 0;
+			}
+			FreeSlot* slot = freeSlots;
+			freeSlots = slot->next;
+
+			u8* page = PageOf(slot);
+			const u32 index = SlotIndex(slot, page);
+			MaskOf(page)[index / 32] |= (1u << (index % 32));
+			numLive += 1;
+			return slot;
+		}
+
+		inline void Unclaim(T* object) {
+			u8* page = PageOf(object);
+			const u32 index = SlotIndex(object, page);
+			MaskOf(page)[index / 32] &= ~(1u << (index % 32));
+			numLive -= 1;
+
+			FreeSlot* slot = (FreeSlot*)object;
+			slot->next = freeSlots;
+			freeSlots = slot;
+		}
+	public:
+		// Each chunk is pagesPerChunk pages. Chunks that would fit a size class are made bigger, so they are
+		// never carved out of a sub-allocator slab that doesn't start on a page.
+		inline Pool(Allocator* _allocator, u32 pagesPerChunk = 16) {
+			allocator = _allocator;
+			chunks = 0;
+			freeSlots = 0;
+			numLive = 0;
+			numSlots = 0;
+			maskSize = (allocator->pageSize / SlotSize + 31) / 32 * (u32)sizeof(u32);
+			chunkSize = (pagesPerChunk > 0 ? pagesPerChunk : 1) * allocator->pageSize - (u32)sizeof(Allocation);
+#if MEM_USE_SUBALLOCATORS
+			while (chunkSize <= SizeClasses[NumSizeClasses - 1]) {
+				chunkSize += allocator->pageSize;
+			}
+#endif
+		}
+
+		inline ~Pool() {
+			Clear();
+		}
+
+		Pool(const Pool&) = delete;
+		Pool& operator=(const Pool&) = delete;
+
+		template<typename A1>
+		inline T* New(A1&& a1, const char* location = 0) {
+			void* memory = Claim(location);
+			return memory == 0 ? 0 : ::new (memory) T(a1);
+		}
+
+		template<typename A1, typename A2>
+		inline T* New(A1&& a1, A2&& a2, const char* location = 0) {
+			void* memory = Claim(location);
+			return memory == 0 ? 0 : ::new (memory) T(a1, a2);
+		}
+
+		template<typename A1, typename A2, typename A3>
+		inline T* New(A1&& a1, A2&& a2, A3&& a3, const char* location = 0) {
+			void* memory = Claim(location);
+			return memory == 0 ? 0 : ::new (memory) T(a1, a2, a3);
+		}
+
+		inline T* New(const char* location = 0) {
+			void* memory = Claim(location);
+			return memory == 0 ? 0 : ::new (memory) T();
+		}
+
+		inline void Delete(T* object) {
+			if (object != 0) {
+				object->T::~T();
+				Unclaim(object);
+			}
+		}
+
+		// Default constructs up to count objects into the objects array. Returns how many were made, which is
+		// only less than count if the allocator ran out of memory.
+		u32 NewArray(T** objects, u32 count, const char* location = 0) {
+			for (u32 i = 0; i < count; ++i) {
+				void* memory = Claim(location);
+				if (memory == 0) {
+					return i;
+				}
+				objects[i] = ::new (memory) T();
+			}
+			return count;
+		}
+
+		void DeleteArray(T** objects, u32 count) {
+			for (u32 i = 0; i < count; ++i) {
+				Delete(objects[i]);
+			}
+		}
+
+		// Calls callback(T*) for every live object, one chunk at a time, in address order within each chunk.
+		// The callback may delete the object it was given.
+		template<typename F>
+		void ForEach(F&& callback) {
+			for (Chunk* chunk = chunks; chunk != 0; chunk = chunk->next) {
+				for (u8* page = FirstPage(chunk); HasPage(chunk, page); page += allocator->pageSize) {
+					u32* mask = MaskOf(page);
+					u8* first = FirstSlot(chunk, page);
+					const u32 firstIndex = SlotIndex(first, page);
+					for (u32 i = 0; i < maskSize / sizeof(u32); ++i) {
+						for (u32 bits = mask[i], bit = 0; bits != 0; bits >>= 1, ++bit) {
+							if (bits & 1) {
+								callback((T*)(first + (i * 32 + bit - firstIndex) * SlotSize));
+							}
+						}
+					}
+				}
+			}
+		}
+
+		// Destroys every live object, the chunks are kept for new objects
+		void DeleteAll() {
+			ForEach([this](T* object) { this->Delete(object); });
+		}
+
+		// Destroys every live object and gives all chunks back to the allocator
+		void Clear() {
+			DeleteAll();
+			while (chunks != 0) {
+				Chunk* chunk = chunks;
+				chunks = chunk->next;
+				allocator->Release(chunk);
+			}
+			freeSlots = 0;
+			numSlots = 0;
+		}
+
+		inline u32 Count() const {
+			return numLive;
+		}
+
+		// How many objects fit in the chunks the pool has now
+		inline u32 Capacity() const {
+			return numSlots;
+		}
+	};
 }
 
 
@@ -374,13 +884,29 @@ namespace Memory {
 // Some compile time asserts to make sure that all our memory is sized correctly and aligns well
 static_assert (sizeof(Memory::Allocator) % 8 == 0, "Memory::Allocator size needs to be 8 byte alignable for the allocation mask to start on u64 alignment without any padding");
 static_assert (Memory::TrackingUnitSize% Memory::AllocatorAlignment == 0, "Memory::MaskTrackerSize must be a multiple of 8 (bits / byte)");
-static_assert (sizeof(Memory::Allocator) == 96 + 8, "Memory::Allocator is not the expected size");
-#if MEM_TRACK_LOCATION
+static_assert (sizeof(Memory::Allocator) == 3 * 8 + 48, "Memory::Allocator is not the expected size");
+static_assert (sizeof(Memory::SizeClassState) == (MEM_THREAD_SAFE ? 64 : 16), "Memory::SizeClassState is not the expected size");
+static_assert (sizeof(Memory::Arena) == Memory::NumSizeClasses * sizeof(Memory::SizeClassState) + 8 + 16, "Memory::Arena is not the expected size");
+static_assert (MEM_KEEP_EMPTY_SLABS >= 0 && MEM_KEEP_EMPTY_SLABS < 256, "MEM_KEEP_EMPTY_SLABS must be between 0 and 255");
+static_assert (MEM_THREAD_CACHE_BLOCKS >= 2 && MEM_THREAD_CACHE_BLOCKS < 0x8000, "MEM_THREAD_CACHE_BLOCKS must be between 2 and 32767");
+#if MEM_COMPACT_HEADER
+	static_assert (sizeof(Memory::Allocation) == 8, "Memory::Allocation should be 8 bytes (64 bits)");
+#elif MEM_TRACK_LOCATION && MEM_TRACK_ACTIVE
 	static_assert (sizeof(Memory::Allocation) == 24, "Memory::Allocation should be 24 bytes (192 bits)");
-#else
+#elif MEM_TRACK_LOCATION || MEM_TRACK_ACTIVE
 	static_assert (sizeof(Memory::Allocation) == 16, "Memory::Allocation should be 16 bytes (128 bits)");
+#else
+	static_assert (sizeof(Memory::Allocation) == 8, "Memory::Allocation should be 8 bytes (64 bits)");
 #endif
 
+namespace Memory {
+	constexpr bool SizeClassesAreValid(u32 i = 0) {
+		return i == NumSizeClasses || (SizeClasses[i] % 8 == 0 && (i == 0 ? SizeClasses[i] >= 8 : SizeClasses[i] > SizeClasses[i - 1]) && SizeClassesAreValid(i + 1));
+	}
+}
+static_assert (Memory::NumSizeClasses > 0 && Memory::NumSizeClasses < 256, "MEM_SIZE_CLASSES must have between 1 and 255 sizes");
+static_assert (Memory::SizeClassesAreValid(), "MEM_SIZE_CLASSES must be ascending multiples of 8, and can't be smaller than 8 bytes");
+
 // Use the __LOCATION__ macro to pack both __LINE__ and __FILE__ into a c string
 #define atlas_xstr(a) atlas_str(a)
 #define atlas_str(a) #a